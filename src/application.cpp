@@ -1,18 +1,53 @@
 #include "application.h"
 
 #include "glad/glad.h"
+#include "gl_state.h"
 #include <iostream>
+#include <algorithm>
+#include <iterator>
 #include "GLFW/glfw3.h"
 #include "gl/GLU.h"
 
+// Written with W, read back with E
+static const char* SCENE_FILE_NAME = "scene.bin";
+
 // Example usage with GLFW
 Application::Application(){
 	initOpenGL();
 	init_fbo();
+	scene_target = new SceneTarget;
+	frame_uniforms = new FrameUniforms;
 	rubberband = new RubberbandSelection(static_cast<float> (windowWidth), static_cast<float> (windowHeight));
-	//instanced_renderer_ = new InstancedRenderer;
 	cube_renderer_ = new CubeRenderer;
 	cube_renderer_->set_section_mode(false);
+	cube_renderer_->set_selection_callback([this](const std::vector<int>& sel_ids) {
+		// A new pick replaces the selection; the flags reach the GPU with the next frame
+		SelectionFlags* selection = cube_renderer_->get_selection();
+		selection->clear();
+		if (!select_assemblies)
+		{
+			std::ranges::for_each(sel_ids, [selection](int id) { selection->set(static_cast<size_t>(id - PICK_FIRST_ID), true); });
+			std::cout << selection->selected_count() << " objects selected\n";
+			return;
+		}
+
+		std::vector<int> assembly_ids = to_assembly_ids(sel_ids);
+		for (int id : assembly_ids)
+		{
+			scene_store->for_each_subtree_range(static_cast<size_t>(id - PICK_FIRST_ID), [selection](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+					selection->set(i, true);
+			});
+		}
+		std::cout << assembly_ids.size() << " assemblies selected, " << selection->selected_count() << " objects\n";
+	});
+	thread_pool = new ThreadPool;
+	scene_loader = new SceneLoader;
+	frustum_selector = new FrustumSelector(thread_pool);
+	scene_store = new SceneStore(thread_pool);
+	scene_file = new SceneFile;
+	scene_spec.assemblies = true;
+	depth_sorter = new DepthSorter(thread_pool);
 	camera = new Camera(glm::vec3(0.f, 0.f, 8.f));
 	cam_ctrl = new CameraController(camera, static_cast<float> (windowWidth), static_cast<float> (windowHeight));
 	camera->setAspectRatio(static_cast<float>(windowWidth) / windowHeight);
@@ -22,8 +57,16 @@ Application::Application(){
 
 Application::~Application() {
 	delete rubberband;
+	delete scene_target;
+	delete frame_uniforms;
 	delete cam_ctrl;
 	delete camera;
+	delete frustum_selector;
+	delete scene_loader;
+	delete scene_file;
+	delete scene_store;
+	delete depth_sorter;
+	delete thread_pool;
 	glfwTerminate();
 }
 
@@ -98,6 +141,127 @@ void Application::setupCallbacks()
 		if (key == GLFW_KEY_P && action == 1)
 		{
 			app->testCoordinateTransformation();
+
+			double xpos, ypos;
+			glfwGetCursorPos(window, &xpos, &ypos);
+			BvhPicker::Hit hit;
+			if (app->pick(xpos, ypos, hit))
+				std::cout << "BVH pick: id " << hit.id << " at (" << hit.point.x << ", " << hit.point.y << ", " << hit.point.z << ")\n";
+			else
+				std::cout << "BVH pick: nothing\n";
+		}
+		else if (key == GLFW_KEY_S && action == 1)
+		{
+			bool region = !app->cube_renderer_->get_pick_region_mode();
+			app->cube_renderer_->set_pick_region_mode(region);
+			std::cout << "Pick pass " << (region ? "sized to the selection rectangle" : "scissored in the full window") << std::endl;
+		}
+		else if (key == GLFW_KEY_O && action == 1)
+		{
+			bool queries = app->cube_renderer_->get_selection_engine() != SelectionEngine::OcclusionQuery;
+			app->cube_renderer_->set_selection_engine(queries ? SelectionEngine::OcclusionQuery : SelectionEngine::PickBuffer);
+			std::cout << "Selection engine: " << (queries ? "occlusion queries" : "pick buffer") << std::endl;
+		}
+		else if (key == GLFW_KEY_T && action == 1)
+		{
+			app->select_through = !app->select_through;
+			std::cout << "Select-through " << (app->select_through ? "on" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_H && action == 1)
+		{
+			bool hover = !app->cube_renderer_->get_hover_mode();
+			app->cube_renderer_->set_hover_mode(hover);
+			std::cout << "Hover highlight " << (hover ? "on" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_C && action == 1)
+		{
+			bool cache = !app->cube_renderer_->get_id_cache_mode();
+			app->cube_renderer_->set_id_cache_mode(cache);
+			std::cout << "ID image cache " << (cache ? "on" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_I && action == 1)
+		{
+			bool instancing = !app->cube_renderer_->get_instancing();
+			app->cube_renderer_->set_instancing(instancing);
+			std::cout << "Instanced drawing " << (instancing ? "on" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_M && action == 1)
+		{
+			app->animate = !app->animate;
+			app->cube_renderer_->get_instanced_renderer()->set_streaming(app->animate);
+			std::cout << "Animation " << (app->animate ? "on, streaming instance data" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_G && action == 1)
+		{
+			app->set_mixed_meshes(app->m_mesh_ids.empty());
+		}
+		else if (key == GLFW_KEY_F && action == 1)
+		{
+			app->culling = !app->culling;
+			app->culled_revision = UINT64_MAX;
+			std::cout << "Frustum culling " << (app->culling ? "on" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_V && action == 1)
+		{
+			app->gl_state_stats = !app->gl_state_stats;
+			std::cout << "GL state statistics " << (app->gl_state_stats ? "on" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_D && action == 1)
+		{
+			app->depth_sort = !app->depth_sort;
+			app->culled_revision = UINT64_MAX;
+			std::cout << "Front-to-back sorting " << (app->depth_sort ? "on" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_L && action == 1)
+		{
+			bool lod = !app->cube_renderer_->get_lod();
+			app->cube_renderer_->set_lod(lod);
+			app->culled_revision = UINT64_MAX;
+			std::cout << "Level of detail " << (lod ? "on" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_N && action == 1)
+		{
+			int shape = (static_cast<int>(app->scene_spec.shape) + 1) % static_cast<int>(SceneShape::SHAPE_COUNT);
+			app->scene_spec.shape = static_cast<SceneShape>(shape);
+			app->update_models();
+		}
+		else if (key == GLFW_KEY_K && action == 1)
+		{
+			const size_t sizes[] = { 27, 100000, 1000000, 10000000, 30000000 };
+			app->scene_size_step = (app->scene_size_step + 1) % static_cast<int>(std::size(sizes));
+			app->scene_spec.count = sizes[app->scene_size_step];
+			app->scene_spec.assemblies = app->scene_size_step == 0;
+			app->update_models();
+		}
+		else if (key == GLFW_KEY_W && action == 1)
+		{
+			app->save_scene(SCENE_FILE_NAME);
+		}
+		else if (key == GLFW_KEY_E && action == 1)
+		{
+			app->load_scene(SCENE_FILE_NAME);
+		}
+		else if (key == GLFW_KEY_B && action == 1)
+		{
+			// 1, 4, 16, 64 MB
+			app->upload_budget = app->upload_budget >= (size_t(64) << 20) ? size_t(1) << 20 : app->upload_budget * 4;
+			std::cout << "Scene upload budget " << (app->upload_budget >> 20) << " MB per frame, from the next load" << std::endl;
+		}
+		else if (key == GLFW_KEY_Y && action == 1)
+		{
+			app->select_assemblies = !app->select_assemblies;
+			std::cout << "Selecting " << (app->select_assemblies ? "whole assemblies" : "single parts") << std::endl;
+		}
+		else if (key == GLFW_KEY_U && action == 1)
+		{
+			app->single_pass = !app->single_pass;
+			std::cout << "Single-pass colour and ID rendering " << (app->single_pass ? "on" : "off") << std::endl;
+		}
+		else if (key == GLFW_KEY_A && action == 1)
+		{
+			bool async = !app->cube_renderer_->get_async_readback();
+			app->cube_renderer_->set_async_readback(async);
+			std::cout << "Async pick readback " << (async ? "on" : "off") << std::endl;
 		}
 	});
 }
@@ -127,14 +291,33 @@ void Application::mouseButtonCallback(int button, int action, int mods) {
 		rubberband_active = false;
 		glm::vec2 start, end;
 		rubberband->endSelection(start, end);
-		cube_renderer_->set_section_mode(true);
 
 		float x = std::min(start.x, end.x);
 		float w = std::max(start.x, end.x) - x;
 		float y = std::min(start.y, end.y);
 		float h = std::max(start.y, end.y) - y;
-
-		cube_renderer_->set_selection_rectangle(x, y, w, h);
+		// Window coordinates start at the top, GL reads start at the bottom
+		y = windowHeight - (y + h);
+		// A drag may end outside the window; scissor and readback stay inside
+		float x_end = std::min(x + w, static_cast<float>(windowWidth));
+		float y_end = std::min(y + h, static_cast<float>(windowHeight));
+		x = std::clamp(x, 0.f, static_cast<float>(windowWidth - 1));
+		y = std::clamp(y, 0.f, static_cast<float>(windowHeight - 1));
+		w = std::max(x_end - x, 0.f);
+		h = std::max(y_end - y, 0.f);
+
+		if (select_through)
+		{
+			// CAD convention: dragging to the right selects what lies fully
+			// inside (window), dragging to the left what it touches (crossing)
+			RectangleSemantics semantics = end.x >= start.x ? RectangleSemantics::Window : RectangleSemantics::Crossing;
+			select_through_rectangle(glm::ivec4(x, y, w, h), semantics);
+		}
+		else
+		{
+			cube_renderer_->set_section_mode(true);
+			cube_renderer_->set_selection_rectangle(x, y, w, h);
+		}
 		//select_in_rectangle(start.x, start.y, end.x, end.y);
 	}
 	else
@@ -153,27 +336,35 @@ void Application::mouseMoveCallback(double xpos, double ypos) {
 	{
 		cam_ctrl->mouseMoveCallback(xpos, ypos);
 	}
-	//
+
+	if (cube_renderer_->get_hover_mode() && !rubberband_active)
+	{
+		hover_pos = glm::ivec2(static_cast<int>(xpos), windowHeight - 1 - static_cast<int>(ypos));
+		// Resolved right away when the ID image is current, otherwise the
+		// next frame issues a small asynchronous pick
+		hover_dirty = !cube_renderer_->hover_from_cache(current_cache_key(), hover_pos.x, hover_pos.y);
+	}
 }
 
 void Application::framebufferSizeCallback(int width, int height) {
 	windowWidth = width;
 	windowHeight = height;
-	glViewport(0, 0, width, height);
+	gl_state().viewport(glm::ivec4(0, 0, width, height));
 	rubberband->updateScreenSize(width, height);
 }
 
 void Application::select_in_rectangle(float st_x, float st_y, float end_x, float end_y)
 {
 	// Clear screen
-	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	gl_state().clear_color(glm::vec4(0.1f, 0.1f, 0.1f, 1.0f));
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	// Render your scene here
 	glm::mat4 view = camera->getViewMatrix();
 	glm::mat4 projection = camera->getProjectionMatrix();
 
 		cube_renderer_->set_section_mode(false);
-		cube_renderer_->pick_render(view, projection, m_models, {});
+		frame_uniforms->use(FrameUniforms::CAMERA, view, projection, glm::ivec4(0, 0, windowWidth, windowHeight));
+		cube_renderer_->pick_render(scene_store->size(), lazy_models());
 		glfwSwapBuffers(window);
 
 	
@@ -181,36 +372,220 @@ void Application::select_in_rectangle(float st_x, float st_y, float end_x, float
 
 void Application::update_models()
 {
-	auto getModelMat = [](glm::vec3 pos) -> glm::mat4
+	drop_packed_instances();
+	if (scene_loader->start(scene_spec, *scene_store, upload_budget))
 	{
-		glm::mat4 model3 = glm::mat4(1.0f);
-		model3 = glm::translate(model3, pos);
+		begin_streaming();
+		return;
+	}
 
-		model3 = glm::rotate(model3, glm::radians(30.f), glm::vec3(1.0f, 0.0f, 0.0f));
-		model3 = glm::rotate(model3, glm::radians(15.f), glm::vec3(0.0f, 1.0f, 0.0f));
-		return model3;
-	};
+	double start = glfwGetTime();
+	generate_scene(scene_spec, *scene_store, thread_pool);
+	double elapsed = glfwGetTime() - start;
+
+	cube_renderer_->get_selection()->clear();
+	cube_renderer_->new_pick_generation();
+	if (!m_mesh_ids.empty())
+		set_mixed_meshes(true);
+	++scene_revision;
+	std::cout << "Scene: " << scene_shape_name(scene_spec.shape) << ", " << scene_store->size()
+		<< " objects, generated in " << elapsed * 1000.0 << " ms" << std::endl;
+}
 
+bool Application::load_scene(const std::string& path)
+{
+	double start = glfwGetTime();
+	SceneFile* file = new SceneFile;
+	if (!file->open(path))
+	{
+		delete file;
+		return false;
+	}
+	// Starting the loader ends the previous load and frees its instances
+	drop_packed_instances();
+	SceneLoader::FileStart streamed = scene_loader->start(file, *scene_store, upload_budget);
+	if (streamed == SceneLoader::FileStart::Streaming)
+	{
+		begin_streaming();
+		return true;
+	}
+	// The rest is loaded at once, from the same mapping
+	if (streamed == SceneLoader::FileStart::Invalid || !file->load(*scene_store, m_mesh_ids, thread_pool))
+	{
+		delete file;
+		return false;
+	}
 
-	float delta_step = 1.1f;
+	// Kept mapped, the scene is drawn from the file's instances
+	delete scene_file;
+	scene_file = file;
+	packed_instances = static_cast<const InstancedRenderer::Instance*>(file->section(SceneFile::INSTANCES, sizeof(InstancedRenderer::Instance)));
+	cube_renderer_->get_selection()->clear();
+	cube_renderer_->new_pick_generation();
+	++scene_revision;
+
+	std::cout << "Scene: " << scene_store->size() << " objects loaded from " << path << " in "
+		<< (glfwGetTime() - start) * 1000.0 << " ms" << (packed_instances ? ", drawn from its packed instances" : "") << std::endl;
+	return true;
+}
 
-	float x = 0.0;
+void Application::begin_streaming()
+{
+	drop_packed_instances();
+	loader_instances_current = true;
+	cube_renderer_->get_selection()->clear();
+	cube_renderer_->new_pick_generation();
+	m_mesh_ids.clear();
+	++scene_revision;
+	stream_start = glfwGetTime();
+	std::cout << "Scene: streaming " << scene_loader->total() << " objects, " << (upload_budget >> 20) << " MB per frame" << std::endl;
+}
+
+void Application::stream_scene()
+{
+	if (!scene_loader->loading())
+		return;
 
-	int grid_size = 3;
-	for(int i = 0; i < grid_size; i++)
+	// Whether the instances of the resident models are up to date
+	bool current = culled_revision == scene_revision;
+	size_t first = scene_store->size();
+	if (scene_loader->update(*scene_store) == 0)
+		return;
+
+	// Once the models have moved, the loader's placements are stale
+	if (loader_instances_current)
+		packed_instances = scene_loader->instances();
+	++scene_revision;
+	if (current && append_instances(first))
+		culled_revision = scene_revision;
+	if (!scene_loader->loading())
+		std::cout << "Scene: " << scene_store->size() << " objects streamed in " << (glfwGetTime() - stream_start) * 1000.0 << " ms" << std::endl;
+}
+
+bool Application::append_instances(size_t first)
+{
+	size_t end = scene_store->size();
+	if (culling)
 	{
-		float y = 0.f;
-		for(int j = 0; j < grid_size; j++)
-		{
-			float z = 0.f;
-			for(int k = 0; k < grid_size; k++)
-			{
-				m_models.push_back(getModelMat(glm::vec3(x, y, z)));
-				z += delta_step;
-			}
-			y += delta_step;
-		}
-		x += delta_step;
+		// Boxes that were current cover the models before `first`
+		if (frustum_revision == scene_revision - 1)
+			frustum_selector->extend(*scene_store, CubeRenderer::CUBE_HALF_EXTENT);
+		else
+			frustum_selector->build(*scene_store, CubeRenderer::CUBE_HALF_EXTENT);
+		frustum_revision = scene_revision;
+		frustum_selector->cull(Frustum::from_matrix(culled_view_projection), first, end, streamed);
+	}
+	else
+	{
+		streamed.resize(end - first);
+		for (size_t i = 0; i < streamed.size(); i++)
+			streamed[i] = static_cast<uint32_t>(first + i);
+	}
+	// Front to back within the new models; the next camera change sorts all
+	if (depth_sort)
+		depth_sorter->sort(*scene_store, m_mesh_ids, camera->getViewMatrix(), streamed);
+
+	if (!cube_renderer_->append_instances(model_source(), m_mesh_ids, streamed, instance_revision + 1))
+		return false;
+	++instance_revision;
+	if (culling || depth_sort)
+		visible.insert(visible.end(), streamed.begin(), streamed.end());
+	return true;
+}
+
+void Application::save_scene(const std::string& path)
+{
+	if (SceneFile::write(path, *scene_store, m_mesh_ids))
+		std::cout << "Scene: " << scene_store->size() << " objects written to " << path << std::endl;
+}
+
+std::vector<int> Application::to_assembly_ids(const std::vector<int>& ids) const
+{
+	std::vector<int> assembly_ids;
+	assembly_ids.reserve(ids.size());
+	for (int id : ids)
+		assembly_ids.push_back(PICK_FIRST_ID + static_cast<int>(scene_store->root_of(static_cast<size_t>(id - PICK_FIRST_ID))));
+
+	std::ranges::sort(assembly_ids);
+	auto duplicates = std::ranges::unique(assembly_ids);
+	assembly_ids.erase(duplicates.begin(), duplicates.end());
+	return assembly_ids;
+}
+
+void Application::animate_models(float dt)
+{
+	// Only the orientations change; the matrices follow when next needed
+	drop_packed_instances();
+	scene_store->rotate_all_local(glm::angleAxis(dt * glm::radians(45.f), glm::vec3(0.0f, 1.0f, 0.0f)));
+	++scene_revision;
+}
+
+InstancedRenderer::ModelSource Application::model_source()
+{
+	if (packed_instances)
+		return InstancedRenderer::ModelSource(packed_instances, scene_store->size());
+	return models();
+}
+
+void Application::drop_packed_instances()
+{
+	loader_instances_current = false;
+	if (!packed_instances)
+		return;
+	packed_instances = nullptr;
+	scene_file->close();
+}
+
+void Application::set_mixed_meshes(bool mixed)
+{
+	m_mesh_ids.clear();
+	if (mixed)
+	{
+		m_mesh_ids.resize(scene_store->size());
+		for (size_t i = 0; i < scene_store->size(); i++)
+			m_mesh_ids[i] = static_cast<uint8_t>(i % MESH_TYPE_COUNT);
+	}
+	++scene_revision;
+
+	bool indirect = cube_renderer_->get_instanced_renderer()->uses_multi_draw_indirect();
+	std::cout << (mixed ? "Mixed meshes" : "Cubes only") << ", drawn with "
+		<< (indirect ? "glMultiDrawElementsIndirect" : "one instanced draw per mesh") << std::endl;
+}
+
+void Application::report_streaming(double now)
+{
+	InstancedRenderer* instanced = cube_renderer_->get_instanced_renderer();
+	if (!instanced->get_streaming() || now - last_stream_report < 2.0)
+		return;
+	last_stream_report = now;
+
+	const StreamBuffer::Stats& stats = instanced->get_stream_stats();
+	std::cout << "instance stream: " << stats.last_frame_bytes / 1024.0 << " KB/frame, "
+		<< stats.stalls << " stalls, " << stats.reallocations << " reallocations\n";
+}
+
+void Application::report_gl_state(double now)
+{
+	if (!gl_state_stats || now - last_state_report < 2.0)
+		return;
+	last_state_report = now;
+
+	const GlState::Counters& counters = gl_state().last_frame();
+	std::cout << "gl state: " << counters.issued << " calls issued, "
+		<< counters.skipped << " redundant calls skipped per frame\n";
+
+	if (cube_renderer_->get_lod())
+	{
+		const size_t* lod = cube_renderer_->get_instanced_renderer()->lod_counts();
+		std::cout << "lod: " << lod[InstancedRenderer::LOD_FULL] << " full, " << lod[InstancedRenderer::LOD_REDUCED] << " reduced, "
+			<< lod[InstancedRenderer::LOD_POINT] << " points\n";
+	}
+
+	if (cube_renderer_->get_id_cache_mode())
+	{
+		const IdImageCache::Stats& cache = cube_renderer_->get_id_cache()->get_stats();
+		std::cout << "id cache: " << cache.hits << " hits, " << cache.misses << " misses ("
+			<< cache.hit_rate() * 100.0 << "%), " << cache.refreshes << " refreshes\n";
 	}
 }
 
@@ -219,27 +594,208 @@ void Application::draw_scene()
 	// Clear screen
 	bool fbo_on = false;
 
+	glm::mat4 view = camera->getViewMatrix();
+	glm::mat4 projection = camera->getProjectionMatrix();
+	IdImageCache::Key cache_key = current_cache_key();
+	glm::ivec4 window_viewport(0, 0, windowWidth, windowHeight);
+	update_instances(view, projection);
+	// Uploaded only when the camera or the window changed
+	frame_uniforms->use(FrameUniforms::CAMERA, view, projection, window_viewport);
+
+	// A hit clears the selection mode, so this frame is a normal one
 	if (cube_renderer_->get_section_mode())
+		cube_renderer_->select_from_cache(cache_key, scene_store->size());
+
+	// The occlusion engine needs its own passes
+	if (single_pass && cube_renderer_->get_selection_engine() == SelectionEngine::PickBuffer)
 	{
+		draw_scene_single_pass(cache_key);
+		return;
+	}
+
+	if (cube_renderer_->get_section_mode())
+	{
+		// Only the selection rectangle is cleared and rasterised. In pick region
+		// mode the FBO is just big enough for it, otherwise it covers the window.
+		glm::ivec4 target = cube_renderer_->pick_target_rect();
+		glm::ivec4 pick_viewport = window_viewport;
+		if (cube_renderer_->get_pick_region_mode())
+		{
+			resize_fbo(target.z, target.w);
+			pick_viewport = glm::ivec4(0, 0, target.z, target.w);
+			gl_state().viewport(pick_viewport);
+		}
+		else
+		{
+			resize_fbo(windowWidth, windowHeight);
+		}
+		if (culling && cube_renderer_->get_selection_engine() == SelectionEngine::PickBuffer)
+		{
+			glm::ivec4 rect = cube_renderer_->get_selection_rectangle();
+			glm::vec2 center(rect.x + rect.z * 0.5f, rect.y + rect.w * 0.5f);
+			cull_pick_pass(view, glm::pickMatrix(center, glm::vec2(rect.z, rect.w), window_viewport) * projection);
+		}
+		frame_uniforms->use(FrameUniforms::PICK_REGION, view, cube_renderer_->pick_projection(projection, window_viewport), pick_viewport);
+
 		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-        glEnable(GL_DEPTH_TEST);
-		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+		gl_state().enable(GL_DEPTH_TEST);
+		gl_state().enable(GL_SCISSOR_TEST);
+		gl_state().scissor(target);
+		// glClearColor does not apply to integer attachments
+		const GLuint background[4] = { PICK_BACKGROUND_ID, 0, 0, 0 };
+		glClearBufferuiv(GL_COLOR, 0, background);
+		glClear(GL_DEPTH_BUFFER_BIT);
 		fbo_on = true;
 	}
 	else
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	{
+		gl_state().clear_color(glm::vec4(0.1f, 0.1f, 0.1f, 1.0f));
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
 	// Render your scene here
-	glm::mat4 view = camera->getViewMatrix();
-	glm::mat4 projection = camera->getProjectionMatrix();
 	//cube_renderer_->set_section_mode(false);
-	cube_renderer_->render(view, projection, m_models, {});
+	cube_renderer_->render(scene_store->size(), lazy_models());
 
 	if(fbo_on) 
 	{
+		gl_state().disable(GL_SCISSOR_TEST);
+		gl_state().viewport(window_viewport);
         glBindFramebuffer(GL_FRAMEBUFFER, 0); // Render to screen.
 	}
+
+	if (cube_renderer_->id_cache_needs_refresh(cache_key))
+		refresh_id_image(cache_key);
+
+	if (hover_dirty && cube_renderer_->can_hover_pick())
+		hover_pick(view, projection);
+
+	// The overlay draws with the window viewport of the camera slot
+	frame_uniforms->use(FrameUniforms::CAMERA);
+}
+
+void Application::draw_scene_single_pass(const IdImageCache::Key& cache_key)
+{
+	// A pending pick is answered from the IDs this visual pass writes
+	bool pick_pending = cube_renderer_->get_section_mode();
+	cube_renderer_->set_section_mode(false);
+
+	scene_target->resize(windowWidth, windowHeight);
+	scene_target->bind();
+	gl_state().enable(GL_DEPTH_TEST);
+	scene_target->clear(glm::vec4(0.1f, 0.1f, 0.1f, 1.0f));
+	cube_renderer_->render(scene_store->size(), lazy_models());
+
+	if (pick_pending)
+		cube_renderer_->read_selection(scene_store->size());
+
+	if (cube_renderer_->id_cache_needs_refresh(cache_key))
+		cube_renderer_->read_id_image(cache_key);
+
+	if (hover_dirty && cube_renderer_->can_hover_pick())
+	{
+		cube_renderer_->read_hover(hover_pos.x, hover_pos.y, windowWidth, windowHeight);
+		hover_dirty = false;
+	}
+
+	scene_target->blit_to_window();
+}
+
+void Application::build_frustum_boxes()
+{
+	if (frustum_revision != scene_revision)
+	{
+		frustum_selector->build(*scene_store, CubeRenderer::CUBE_HALF_EXTENT);
+		frustum_revision = scene_revision;
+	}
+}
+
+void Application::update_instances(const glm::mat4& view, const glm::mat4& projection)
+{
+	// Its own counter: with culling or sorting the instances change with the
+	// view, not only with the scene. A camera that has not moved keeps both.
+	glm::mat4 view_projection = projection * view;
+	bool view_dependent = culling || depth_sort;
+	bool lod = cube_renderer_->get_lod();
+	if (culled_revision != scene_revision || ((view_dependent || lod) && view_projection != culled_view_projection))
+	{
+		if (lod)
+			cube_renderer_->set_lod_camera(view_projection, projection, glm::ivec4(0, 0, windowWidth, windowHeight));
+		if (culling)
+		{
+			build_frustum_boxes();
+			frustum_selector->cull(Frustum::from_matrix(view_projection), visible);
+		}
+		else if (depth_sort)
+		{
+			visible.resize(scene_store->size());
+			for (size_t i = 0; i < visible.size(); i++)
+				visible[i] = static_cast<uint32_t>(i);
+		}
+		// Without a hierarchy the positions are in the store, no matrices needed
+		if (depth_sort && scene_store->hierarchical())
+			depth_sorter->sort(models(), m_mesh_ids, view, visible);
+		else if (depth_sort)
+			depth_sorter->sort(*scene_store, m_mesh_ids, view, visible);
+		culled_view_projection = view_projection;
+		culled_revision = scene_revision;
+		++instance_revision;
+	}
+	cube_renderer_->update_instances(model_source(), m_mesh_ids, instance_revision, view_dependent ? &visible : nullptr);
+}
+
+void Application::cull_pick_pass(const glm::mat4& view, const glm::mat4& pick_projection)
+{
+	build_frustum_boxes();
+	frustum_selector->cull(Frustum::from_matrix(pick_projection * view), pick_candidates);
+	cube_renderer_->set_pick_candidates(model_source(), pick_candidates);
+}
+
+IdImageCache::Key Application::current_cache_key() const
+{
+	return { camera->getViewMatrix(), camera->getProjectionMatrix(), glm::ivec2(windowWidth, windowHeight), scene_revision };
+}
+
+void Application::hover_pick(const glm::mat4& view, const glm::mat4& projection)
+{
+	// Only the aperture around the cursor is rasterised
+	const int aperture = CubeRenderer::HOVER_APERTURE;
+	glm::ivec4 window_viewport(0, 0, windowWidth, windowHeight);
+	glm::mat4 pick_projection = glm::pickMatrix(glm::vec2(hover_pos) + 0.5f, glm::vec2(aperture), window_viewport) * projection;
+
+	resize_fbo(aperture, aperture);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glm::ivec4 aperture_rect(0, 0, aperture, aperture);
+	gl_state().viewport(aperture_rect);
+	gl_state().enable(GL_SCISSOR_TEST);
+	gl_state().scissor(aperture_rect);
+	const GLuint background[4] = { PICK_BACKGROUND_ID, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, background);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	if (culling)
+		cull_pick_pass(view, pick_projection);
+	frame_uniforms->use(FrameUniforms::HOVER, view, pick_projection, aperture_rect);
+	cube_renderer_->render_hover_pick(scene_store->size(), lazy_models());
+
+	gl_state().disable(GL_SCISSOR_TEST);
+	gl_state().viewport(window_viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	hover_dirty = false;
+}
+
+void Application::refresh_id_image(const IdImageCache::Key& key)
+{
+	// The key is the current camera, already in the camera slot
+	frame_uniforms->use(FrameUniforms::CAMERA);
+	resize_fbo(key.size.x, key.size.y);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	const GLuint background[4] = { PICK_BACKGROUND_ID, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, background);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	cube_renderer_->render_id_image(scene_store->size(), lazy_models(), key);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 
@@ -248,28 +804,46 @@ void Application::init_fbo()
 	// Create a framebuffer object
 	glGenFramebuffers(1, &FBO);
 	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-	// create a color attachment texture
-    GLuint textureColorbuffer;
-    glGenTextures(1, &textureColorbuffer);
-    glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, windowWidth, windowHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureColorbuffer, 0);
+	// create a 32-bit integer object ID attachment
+    glGenTextures(1, &pick_id_texture);
+    glBindTexture(GL_TEXTURE_2D, pick_id_texture);
+    // Integer textures cannot be filtered
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pick_id_texture, 0);
 
 // Create depth buffer
-    GLuint depthBuffer;
-    glGenRenderbuffers(1, &depthBuffer);
-    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, windowWidth, windowHeight);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
-    
+    glGenRenderbuffers(1, &pick_depth_buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, pick_depth_buffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, pick_depth_buffer);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Storage is allocated lazily at the size of the first pick
+}
+
+void Application::resize_fbo(int width, int height)
+{
+	// Grow only, a smaller pick reuses the storage and scissors the rest
+	if (width <= fbo_width && height <= fbo_height)
+		return;
+
+	fbo_width = std::max(width, fbo_width);
+	fbo_height = std::max(height, fbo_height);
+
+    glBindTexture(GL_TEXTURE_2D, pick_id_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, fbo_width, fbo_height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, pick_depth_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, fbo_width, fbo_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         std::cout << "Framebuffer not complete!" << std::endl;
     }
-    
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void Application::testCoordinateTransformation()
@@ -297,7 +871,7 @@ void Application::testCoordinateTransformation()
 	std::cout << "WINDOW = (" << wPos.x << ", " << wPos.y << ", " << wPos.z << ")\n";
 	std::cout << "VIEW = (" << modelPos.x << ", " << modelPos.y << ", " << modelPos.z << ")\n";
 
-	glm::vec4 in_one = glm::inverse(m_models[0]) * glm::vec4(modelPos, 1.0);
+	glm::vec4 in_one = glm::inverse(models()[0]) * glm::vec4(modelPos, 1.0);
 	std::cout << "MODEL = (" << in_one.x << ", " << in_one.y << ", " << in_one.z << ")\n";
 
 	wPos = glm::project(modelPos, modelMatrix, projectionMatrix, vwprt);
@@ -305,20 +879,60 @@ void Application::testCoordinateTransformation()
 	std::cout << "RECOVER = (" << wx << ", " << wy << ", " << wz << ")\n";
 }
 
-void Application::run() {
+bool Application::pick(double xpos, double ypos, BvhPicker::Hit& hit)
+{
+	// Rebuilt lazily, only after the scene has changed
+	if (bvh_revision != scene_revision)
+	{
+		bvh.build(models(), CubeRenderer::CUBE_HALF_EXTENT);
+		bvh_revision = scene_revision;
+	}
 
-	//instanced_renderer_->addInstance(Transform(glm::vec3(0.0f, 0.0f, 0.0f)));
-	//instanced_renderer_->addInstance(Transform(glm::vec3(2.0f, 0.0f, 0.0f), glm::vec3(30.0f, 30.0f, 0.0f)));
-	//instanced_renderer_->addInstance(Transform(glm::vec3(-2.0f, 0.0f, 0.0f), glm::vec3(30.0f, 45.0f, 0.f), glm::vec3(0.5f)));
-	update_models();
-	glEnable(GL_DEPTH_TEST);
+	glm::ivec4 viewport(0, 0, windowWidth, windowHeight);
+	// Cursor positions are continuous, only the y axis needs flipping
+	float x = static_cast<float>(xpos);
+	float y = static_cast<float>(windowHeight - ypos);
+	return bvh.pick(x, y, camera->getViewMatrix(), camera->getProjectionMatrix(), viewport, hit);
+}
+
+void Application::select_through_rectangle(const glm::ivec4& rect, RectangleSemantics semantics)
+{
+	auto on_complete = cube_renderer_->timed_callback(semantics == RectangleSemantics::Window ? "window (select-through)" : "crossing (select-through)");
+
+	build_frustum_boxes();
+
+	std::vector<int> sel_ids;
+	glm::ivec4 viewport(0, 0, windowWidth, windowHeight);
+	frustum_selector->select(rect, camera->getViewMatrix(), camera->getProjectionMatrix(), viewport, semantics, sel_ids);
+	on_complete(sel_ids);
+}
+
+void Application::run(const char* scene_path) {
+
+	if (!scene_path || !load_scene(scene_path))
+		update_models();
+	gl_state().enable(GL_DEPTH_TEST);
+	last_frame_time = glfwGetTime();
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
 
+		double now = glfwGetTime();
+		if (animate)
+			animate_models(static_cast<float>(now - last_frame_time));
+		last_frame_time = now;
+
+		// Picking only sees what has fully arrived
+		stream_scene();
+		cube_renderer_->set_pickable_count(scene_store->size());
 		draw_scene();
+		report_streaming(now);
+		report_gl_state(now);
+		// Hand over pick results whose readback has completed
+		cube_renderer_->poll_selection();
 		// Render rubberband selection on top
 		rubberband->render();
 
 		glfwSwapBuffers(window);
+		gl_state().end_frame();
 	}
 }
@@ -5,23 +5,86 @@
 
 #include "basic_camera.h"
 #include "rubberband_glsl.h"
-//#include "instanced_renderer.h"
 #include "cube_vbo.h"
+#include "bvh_picker.h"
+#include "frustum_selector.h"
+#include "thread_pool.h"
+#include "depth_sort.h"
+#include "scene_store.h"
+#include "scene_generator.h"
+#include "scene_file.h"
+#include "scene_loader.h"
+#include "frame_uniforms.h"
+#include "scene_target.h"
 
 // Example usage with GLFW
 class Application {
 private:
     GLFWwindow* window;
     RubberbandSelection* rubberband;
-    //InstancedRenderer* instanced_renderer_;
+    FrameUniforms* frame_uniforms;
     CubeRenderer* cube_renderer_;
     int windowWidth = 800;
     int windowHeight = 600;
     Camera* camera;
     CameraController* cam_ctrl;
     bool rubberband_active = false;
-    std::vector<glm::mat4> m_models;
+    SceneStore* scene_store;
+    // What update_models() generates; the demo assemblies at the smallest size
+    SceneSpec scene_spec;
+    int scene_size_step = 0;
+    // Flat scenes arrive over several frames, at most upload_budget bytes of
+    // new instances each; a changed budget applies from the next load
+    SceneLoader* scene_loader;
+    size_t upload_budget = size_t(16) << 20;
+    std::vector<uint32_t> streamed;
+    double stream_start = 0.0;
+    std::vector<uint8_t> m_mesh_ids;  // MeshType per model, all cubes while empty
+    // The scene file the scene was loaded from stays mapped while its packed
+    // instances still match the store: they are drawn as they are, and world
+    // matrices are only built if something else (picking, culling) needs them
+    SceneFile* scene_file;
+    const InstancedRenderer::Instance* packed_instances = nullptr;
+    // The streaming loader's instances still match the store: nothing has
+    // moved the models since the load began
+    bool loader_instances_current = false;
+    uint64_t scene_revision = 0;
+    // Cursor position waiting for a hover pick, bottom-left origin
+    glm::ivec2 hover_pos;
+    bool hover_dirty = false;
+    BvhPicker bvh;
+    uint64_t bvh_revision = 0;
+    ThreadPool* thread_pool;
+    FrustumSelector* frustum_selector;
+    uint64_t frustum_revision = 0;
+    // Frustum culling: models inside the camera frustum, recomputed when the
+    // view or the scene changes, and the candidates of the current pick region
+    bool culling = true;
+    std::vector<uint32_t> visible;
+    std::vector<uint32_t> pick_candidates;
+    glm::mat4 culled_view_projection;
+    uint64_t culled_revision = UINT64_MAX;
+    uint64_t instance_revision = 0;
+    // Front-to-back order of the drawn models, redone with the culling
+    bool depth_sort = true;
+    DepthSorter* depth_sorter;
+    bool select_through = false;
+    // Selection resolves picked parts to their top-level assembly and all its parts
+    bool select_assemblies = false;
+    // Spin every model each frame; the instance data is then streamed
+    bool animate = false;
+    double last_frame_time = 0.0;
+    double last_stream_report = 0.0;
+    bool gl_state_stats = false;
+    double last_state_report = 0.0;
+    // Single-pass mode: colour and IDs in one visual pass into scene_target
+    bool single_pass = false;
+    SceneTarget* scene_target;
     GLuint FBO;
+    GLuint pick_id_texture;
+    GLuint pick_depth_buffer;
+    int fbo_width = 0;
+    int fbo_height = 0;
 public:
     Application();
 
@@ -37,12 +100,54 @@ private:
 
     void framebufferSizeCallback(int width, int height);
     void select_in_rectangle(float st_x, float st_y, float end_x, float end_y);
+    // World matrices of the scene, rebuilt lazily by the store.
+    const std::vector<glm::mat4>& models() { return scene_store->world_matrices(); }
+    // The same for the renderer, which only builds them when it has to.
+    CubeRenderer::ModelMatrices lazy_models() { return [this]() -> const std::vector<glm::mat4>& { return models(); }; }
+    // Placement of the models for the instanced path: the packed instances if any, else models().
+    InstancedRenderer::ModelSource model_source();
+    // The transforms no longer match the packed instances; unmaps the scene file.
+    void drop_packed_instances();
+    // Regenerate the scene from scene_spec; drops the selection.
     void update_models();
+    // Replace the scene by the one in a scene file; false leaves it as it was.
+    bool load_scene(const std::string& path);
+    void save_scene(const std::string& path);
+    // Set up drawing for the load scene_loader has just started.
+    void begin_streaming();
+    // Take this frame's share of the loading scene.
+    void stream_scene();
+    // Cull, sort and upload only the models from `first` on, which have just
+    // arrived; false if the instances have to be rebuilt as a whole instead.
+    bool append_instances(size_t first);
+    // Pick IDs of the top-level assemblies of the picked objects, sorted and distinct.
+    std::vector<int> to_assembly_ids(const std::vector<int>& ids) const;
+    void animate_models(float dt);
+    void set_mixed_meshes(bool mixed);
+    void report_streaming(double now);
+    void report_gl_state(double now);
     void draw_scene();
+    void draw_scene_single_pass(const IdImageCache::Key& cache_key);
+    void build_frustum_boxes();
+    void update_instances(const glm::mat4& view, const glm::mat4& projection);
+    // Limit the next pick pass to the models inside the frustum of `pick_projection`.
+    void cull_pick_pass(const glm::mat4& view, const glm::mat4& pick_projection);
+    IdImageCache::Key current_cache_key() const;
+    void hover_pick(const glm::mat4& view, const glm::mat4& projection);
+    void refresh_id_image(const IdImageCache::Key& key);
     void init_fbo();
+    void resize_fbo(int width, int height);
 
     void testCoordinateTransformation();
 
+    // Ray-cast the cursor position (window coordinates) against the BVH, no GPU involved.
+    bool pick(double xpos, double ypos, BvhPicker::Hit& hit);
+
+    // Select every object in the rectangle (bottom-left origin), occluded or not.
+    void select_through_rectangle(const glm::ivec4& rect, RectangleSemantics semantics);
+
 public:
-    void run();
+    // Load `scene_path` if given and readable, else generate the demo scene.
+    // Flat scenes are streamed in while the first frames are already drawn.
+    void run(const char* scene_path = nullptr);
 }; 
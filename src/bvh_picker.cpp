@@ -0,0 +1,280 @@
+#include "bvh_picker.h"
+#include "pick_readback.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <limits>
+
+namespace {
+	constexpr int SAH_BINS = 12;
+	constexpr uint32_t MAX_LEAF_SIZE = 4;
+	constexpr float INF = std::numeric_limits<float>::infinity();
+
+	// Entry distance of the ray into the box, or INF if it misses or enters beyond max_t
+	inline float slab(const glm::vec3& bmin, const glm::vec3& bmax, const glm::vec3& origin, const glm::vec3& inv_dir, float max_t)
+	{
+		glm::vec3 t0 = (bmin - origin) * inv_dir;
+		glm::vec3 t1 = (bmax - origin) * inv_dir;
+		glm::vec3 tnear = glm::min(t0, t1);
+		glm::vec3 tfar = glm::max(t0, t1);
+		float enter = std::max(std::max(tnear.x, tnear.y), std::max(tnear.z, 0.f));
+		float exit = std::min(std::min(tfar.x, tfar.y), std::min(tfar.z, max_t));
+		return enter <= exit ? enter : INF;
+	}
+
+	inline float area(const glm::vec3& bmin, const glm::vec3& bmax)
+	{
+		glm::vec3 e = bmax - bmin;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+}
+
+void BvhPicker::build(const std::vector<glm::mat4>& models, float half_extent)
+{
+	half = half_extent;
+	nodes.clear();
+	primitives.clear();
+	max_depth = 0;
+	if (models.empty())
+		return;
+
+	size_t n = models.size();
+	std::vector<glm::vec3> bmins(n), bmaxs(n), centers(n);
+	std::vector<uint32_t> order(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		// World AABB of the oriented box: centre plus the absolute rotation/scale applied to the half extents
+		const glm::mat4& m = models[i];
+		glm::vec3 extent = half * (glm::abs(glm::vec3(m[0])) + glm::abs(glm::vec3(m[1])) + glm::abs(glm::vec3(m[2])));
+		centers[i] = glm::vec3(m[3]);
+		bmins[i] = centers[i] - extent;
+		bmaxs[i] = centers[i] + extent;
+		order[i] = static_cast<uint32_t>(i);
+	}
+
+	nodes.reserve(2 * n);
+	nodes.push_back({ glm::vec3(0.f), 0, glm::vec3(0.f), static_cast<uint32_t>(n) });
+
+	// With a work list instead of recursion: clustered scenes can give
+	// lopsided trees far deeper than log2(n)
+	std::vector<std::pair<uint32_t, uint32_t>> pending{ { 0, 0 } };   // node, depth
+	while (!pending.empty())
+	{
+		auto [node_index, depth] = pending.back();
+		pending.pop_back();
+		max_depth = std::max(max_depth, depth);
+		if (subdivide(node_index, bmins, bmaxs, centers, order))
+		{
+			uint32_t left = nodes[node_index].first;
+			pending.push_back({ left + 1, depth + 1 });
+			pending.push_back({ left, depth + 1 });
+		}
+	}
+
+	// Store the primitives in leaf order so a leaf reads one contiguous block
+	primitives.resize(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		primitives[i].to_local = glm::inverse(models[order[i]]);
+		primitives[i].id = PICK_FIRST_ID + static_cast<int>(order[i]);
+	}
+}
+
+bool BvhPicker::subdivide(uint32_t node_index, std::vector<glm::vec3>& bmins, std::vector<glm::vec3>& bmaxs, std::vector<glm::vec3>& centers, std::vector<uint32_t>& order)
+{
+	uint32_t first = nodes[node_index].first;
+	uint32_t count = nodes[node_index].count;
+
+	glm::vec3 bmin(INF), bmax(-INF), cmin(INF), cmax(-INF);
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		uint32_t p = order[i];
+		bmin = glm::min(bmin, bmins[p]);
+		bmax = glm::max(bmax, bmaxs[p]);
+		cmin = glm::min(cmin, centers[p]);
+		cmax = glm::max(cmax, centers[p]);
+	}
+	nodes[node_index].bmin = bmin;
+	nodes[node_index].bmax = bmax;
+
+	if (count <= MAX_LEAF_SIZE)
+		return false;
+
+	// Binned SAH over the centroid bounds on every axis
+	int best_axis = -1;
+	int best_split = 0;
+	float best_cost = INF;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = cmax[axis] - cmin[axis];
+		if (extent <= 0.f)
+			continue;
+
+		glm::vec3 bin_min[SAH_BINS], bin_max[SAH_BINS];
+		uint32_t bin_count[SAH_BINS] = {};
+		std::fill(bin_min, bin_min + SAH_BINS, glm::vec3(INF));
+		std::fill(bin_max, bin_max + SAH_BINS, glm::vec3(-INF));
+
+		float scale = SAH_BINS / extent;
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			uint32_t p = order[i];
+			int b = std::min(SAH_BINS - 1, static_cast<int>((centers[p][axis] - cmin[axis]) * scale));
+			bin_count[b]++;
+			bin_min[b] = glm::min(bin_min[b], bmins[p]);
+			bin_max[b] = glm::max(bin_max[b], bmaxs[p]);
+		}
+
+		// Sweep from the right to get the cost of every right-hand side, then from the left
+		float right_area[SAH_BINS];
+		uint32_t right_count[SAH_BINS];
+		glm::vec3 rmin(INF), rmax(-INF);
+		uint32_t rc = 0;
+		for (int b = SAH_BINS - 1; b > 0; b--)
+		{
+			rc += bin_count[b];
+			rmin = glm::min(rmin, bin_min[b]);
+			rmax = glm::max(rmax, bin_max[b]);
+			right_count[b] = rc;
+			right_area[b] = rc ? area(rmin, rmax) : 0.f;
+		}
+
+		glm::vec3 lmin(INF), lmax(-INF);
+		uint32_t lc = 0;
+		for (int b = 0; b < SAH_BINS - 1; b++)
+		{
+			lc += bin_count[b];
+			lmin = glm::min(lmin, bin_min[b]);
+			lmax = glm::max(lmax, bin_max[b]);
+			if (lc == 0 || right_count[b + 1] == 0)
+				continue;
+			float cost = lc * area(lmin, lmax) + right_count[b + 1] * right_area[b + 1];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b + 1;
+			}
+		}
+	}
+
+	// All centroids coincide: nothing to gain from splitting
+	if (best_axis < 0)
+		return false;
+
+	float scale = SAH_BINS / (cmax[best_axis] - cmin[best_axis]);
+	auto middle = std::partition(order.begin() + first, order.begin() + first + count, [&](uint32_t p) {
+		int b = std::min(SAH_BINS - 1, static_cast<int>((centers[p][best_axis] - cmin[best_axis]) * scale));
+		return b < best_split;
+	});
+	uint32_t left_count = static_cast<uint32_t>(middle - (order.begin() + first));
+	if (left_count == 0 || left_count == count)
+		return false;
+
+	uint32_t left = static_cast<uint32_t>(nodes.size());
+	nodes.push_back({ glm::vec3(0.f), first, glm::vec3(0.f), left_count });
+	nodes.push_back({ glm::vec3(0.f), first + left_count, glm::vec3(0.f), count - left_count });
+	nodes[node_index].first = left;
+	nodes[node_index].count = 0;
+	return true;
+}
+
+bool BvhPicker::raycast(const glm::vec3& origin, const glm::vec3& direction, Hit& hit) const
+{
+	if (nodes.empty() || glm::dot(direction, direction) == 0.f)
+		return false;
+
+	glm::vec3 dir = glm::normalize(direction);
+	glm::vec3 inv_dir = 1.f / dir;
+	float best_t = INF;
+	int best_id = -1;
+
+	const glm::vec3 box_min(-half), box_max(half);
+
+	// Nodes are stacked with their entry distance, so that those behind a hit
+	// found in the meantime are dropped without touching them again. Each
+	// level leaves at most its far child behind, so depth + 1 entries suffice;
+	// small trees use the array, deep ones a vector.
+	constexpr uint32_t STACK_SIZE = 128;
+	uint32_t fixed_stack[STACK_SIZE];
+	float fixed_stack_t[STACK_SIZE];
+	std::vector<uint32_t> deep_stack;
+	std::vector<float> deep_stack_t;
+	uint32_t* stack = fixed_stack;
+	float* stack_t = fixed_stack_t;
+	if (max_depth + 1 > STACK_SIZE)
+	{
+		deep_stack.resize(max_depth + 1);
+		deep_stack_t.resize(max_depth + 1);
+		stack = deep_stack.data();
+		stack_t = deep_stack_t.data();
+	}
+	int top = 0;
+	float root_t = slab(nodes[0].bmin, nodes[0].bmax, origin, inv_dir, best_t);
+	if (root_t == INF)
+		return false;
+	stack[top] = 0;
+	stack_t[top++] = root_t;
+
+	while (top > 0)
+	{
+		--top;
+		if (stack_t[top] >= best_t)
+			continue;
+		const Node& node = nodes[stack[top]];
+		if (node.count)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				// Exact test against the oriented box in its own space; the
+				// model matrix is affine so t is the same in both spaces
+				const Primitive& prim = primitives[i];
+				glm::vec3 local_origin = glm::vec3(prim.to_local * glm::vec4(origin, 1.f));
+				glm::vec3 local_dir = glm::vec3(prim.to_local * glm::vec4(dir, 0.f));
+				float t = slab(box_min, box_max, local_origin, 1.f / local_dir, best_t);
+				if (t < best_t)
+				{
+					best_t = t;
+					best_id = prim.id;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first, skip children beyond the best hit
+		uint32_t near_child = node.first, far_child = node.first + 1;
+		float t_near = slab(nodes[near_child].bmin, nodes[near_child].bmax, origin, inv_dir, best_t);
+		float t_far = slab(nodes[far_child].bmin, nodes[far_child].bmax, origin, inv_dir, best_t);
+		if (t_far < t_near)
+		{
+			std::swap(near_child, far_child);
+			std::swap(t_near, t_far);
+		}
+		if (t_far != INF)
+		{
+			stack[top] = far_child;
+			stack_t[top++] = t_far;
+		}
+		if (t_near != INF)
+		{
+			stack[top] = near_child;
+			stack_t[top++] = t_near;
+		}
+	}
+
+	if (best_id < 0)
+		return false;
+
+	hit.id = best_id;
+	hit.distance = best_t;
+	hit.point = origin + dir * best_t;
+	return true;
+}
+
+bool BvhPicker::pick(float x, float y, const glm::mat4& view, const glm::mat4& projection, const glm::ivec4& viewport, Hit& hit) const
+{
+	glm::vec4 vp(viewport);
+	glm::vec3 near_point = glm::unProject(glm::vec3(x, y, 0.f), view, projection, vp);
+	glm::vec3 far_point = glm::unProject(glm::vec3(x, y, 1.f), view, projection, vp);
+	return raycast(near_point, far_point - near_point, hit);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// CPU picking without any GPU round-trip.
+// Every model is the unit cube scaled by a half extent and placed by its model
+// matrix, i.e. an oriented box. A bounding volume hierarchy over the world
+// AABBs of those boxes is built with binned SAH into one flat node array;
+// a ray walks it front to back and is tested exactly against the oriented
+// box in the model's local space at the leaves.
+class BvhPicker {
+public:
+    struct Hit {
+        int id;             // pick ID, PICK_FIRST_ID + model index
+        float distance;     // along the (normalised) ray
+        glm::vec3 point;    // world space
+    };
+
+    void build(const std::vector<glm::mat4>& models, float half_extent);
+
+    // Nearest box hit by the ray. `direction` does not need to be normalised.
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, Hit& hit) const;
+
+    // Cast the ray through a window position (bottom-left origin).
+    bool pick(float x, float y, const glm::mat4& view, const glm::mat4& projection, const glm::ivec4& viewport, Hit& hit) const;
+
+    size_t node_count() const { return nodes.size(); }
+    // Levels below the root; bounds the traversal stack of raycast().
+    uint32_t depth() const { return max_depth; }
+
+private:
+    struct Node {
+        glm::vec3 bmin;
+        uint32_t first;     // leaf: first primitive, inner: left child (right is first + 1)
+        glm::vec3 bmax;
+        uint32_t count;     // primitives in a leaf, 0 for inner nodes
+    };
+
+    struct Primitive {
+        glm::mat4 to_local;
+        int id;
+    };
+
+    // Split a node in two by SAH; false if it stays a leaf.
+    bool subdivide(uint32_t node_index, std::vector<glm::vec3>& bmins, std::vector<glm::vec3>& bmaxs, std::vector<glm::vec3>& centers, std::vector<uint32_t>& order);
+
+    std::vector<Node> nodes;
+    std::vector<Primitive> primitives;
+    float half = 0.f;
+    uint32_t max_depth = 0;
+};
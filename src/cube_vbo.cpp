@@ -5,25 +5,29 @@
 #include <iostream>
 #include <vector>
 #include "cube_vbo.h"
+#include "gl_state.h"
 
 #include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <iterator>
 #include <set>
 
 // Vertex shader source
 const char* vertexShaderSource = R"(
 #version 330 compatibility
+)" FRAME_UNIFORM_BLOCK R"(
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
 
 out vec3 vertexColor;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = viewProjection * model * vec4(aPos, 1.0);
     vertexColor = aColor;
 }
 )";
@@ -32,17 +36,25 @@ void main()
 const char* fragmentShaderSource = R"(
 #version 330 compatibility
 in vec3 vertexColor;
-out vec4 FragColor;
-
+// Output 1 only reaches a buffer when drawing into a SceneTarget
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out uint PickId;
 
+// 1 hovered, 2 selected
 uniform int selected;
+uniform uint pickId;
 
 void main()
 {
+	PickId = pickId;
 	if(selected == 1)
 	{
 		FragColor = vec4(0.8, 0.8, 0.8, 1.0);
 	}
+	else if(selected == 2)
+	{
+		FragColor = vec4(mix(vertexColor, vec3(1.0, 0.6, 0.1), 0.7), 1.0);
+	}
 	else
 	{
 		FragColor = vec4(vertexColor, 1.0);
@@ -54,29 +66,28 @@ void main()
 
 const char* picking_vertexSrc = R"(
 #version 330 compatibility
+)" FRAME_UNIFORM_BLOCK R"(
 layout (location = 0) in vec3 aPos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main()
 {
-	 gl_Position = projection * view * model * vec4(aPos, 1.0);	
+	 gl_Position = viewProjection * model * vec4(aPos, 1.0);	
 }
 )";
 
 
 const char* picking_fragmentSrc = R"(
 #version 330 compatibility
-// Ouput data
-out vec4 color;
+// Ouput data: the object ID, written unconverted to the R32UI attachment
+out uint PickId;
 
-uniform vec4 PickingColor;
+uniform uint PickingId;
 
 void main()
 {
-	color = PickingColor;
+	PickId = PickingId;
 }
 )";
 
@@ -86,13 +97,22 @@ CubeRenderer::CubeRenderer() {
 	pickShaderPrg = setupShaders(picking_vertexSrc, picking_fragmentSrc);
 	updatePickingUniformLocs();
 	setupBuffers();
+	instanced = new InstancedRenderer(meshes);
+	selection = new SelectionFlags;
+	readback = new PickReadback;
+	occlusion = new OcclusionSelector;
+	id_cache = new IdImageCache;
 }
 
 CubeRenderer::~CubeRenderer() {
 	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
 	glDeleteProgram(shaderProgram);
+	delete instanced;
+	delete selection;
+	delete meshes;
+	delete readback;
+	delete occlusion;
+	delete id_cache;
 }
 
 bool CubeRenderer::get_section_mode()
@@ -143,6 +163,7 @@ GLuint CubeRenderer::setupShaders(const char* vertex_src, const char* frag_src)
 	glDeleteShader(vertexShader);
 	glDeleteShader(fragmentShader);
 
+	FrameUniforms::attach(shader_program);
 
 	return shader_program;
 
@@ -152,9 +173,8 @@ void CubeRenderer::getUniformLocations()
 {
 	// Get uniform locations
 	modelLoc = glGetUniformLocation(shaderProgram, "model");
-	viewLoc = glGetUniformLocation(shaderProgram, "view");
-	projectionLoc = glGetUniformLocation(shaderProgram, "projection");
 	selectedLoc = glGetUniformLocation(shaderProgram, "selected");
+	pickIdLoc = glGetUniformLocation(shaderProgram, "pickId");
 
 }
 
@@ -162,15 +182,13 @@ void CubeRenderer::updatePickingUniformLocs()
 {
 	// Get uniform locations
 	p_modelLoc = glGetUniformLocation(pickShaderPrg, "model");
-	p_viewLoc= glGetUniformLocation(pickShaderPrg, "view");
-	p_projectionLoc = glGetUniformLocation(pickShaderPrg, "projection");
-	p_picking_color = glGetUniformLocation(pickShaderPrg, "PickingColor");
+	p_picking_id = glGetUniformLocation(pickShaderPrg, "PickingId");
 }
 
 void CubeRenderer::setupBuffers() {
 
 
-	float size = 0.1f;
+	float size = CUBE_HALF_EXTENT;
 	// Cube vertices with positions and colors
 	float vertices[] = {
 		// Front face (red)
@@ -211,7 +229,7 @@ void CubeRenderer::setupBuffers() {
 	};
 
 	// Indices for cube faces
-	unsigned int indices[] = {
+	GLuint indices[] = {
 		// Front face
 		0, 1, 2, 2, 3, 0,
 		// Back face
@@ -226,29 +244,94 @@ void CubeRenderer::setupBuffers() {
 		20, 21, 22, 22, 23, 20
 	};
 
-	// Generate and bind VAO
-	glGenVertexArrays(1, &VAO);
-	glBindVertexArray(VAO);
+	// Square pyramid inside the same bounds, apex up
+	float pyramid_vertices[] = {
+		// Base (cyan)
+		-size, -size, -size,  0.0f, 1.0f, 1.0f,
+		 size, -size, -size,  0.0f, 1.0f, 1.0f,
+		 size, -size,  size,  0.0f, 1.0f, 1.0f,
+		-size, -size,  size,  0.0f, 1.0f, 1.0f,
 
-	// Generate and bind VBO
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+		// Front (red), right (yellow), back (green), left (blue)
+		-size, -size,  size,  1.0f, 0.0f, 0.0f,
+		 size, -size,  size,  1.0f, 0.0f, 0.0f,
+		 0.0f,  size,  0.0f,  1.0f, 0.0f, 0.0f,
+
+		 size, -size,  size,  1.0f, 1.0f, 0.0f,
+		 size, -size, -size,  1.0f, 1.0f, 0.0f,
+		 0.0f,  size,  0.0f,  1.0f, 1.0f, 0.0f,
+
+		 size, -size, -size,  0.0f, 1.0f, 0.0f,
+		-size, -size, -size,  0.0f, 1.0f, 0.0f,
+		 0.0f,  size,  0.0f,  0.0f, 1.0f, 0.0f,
+
+		-size, -size, -size,  0.0f, 0.0f, 1.0f,
+		-size, -size,  size,  0.0f, 0.0f, 1.0f,
+		 0.0f,  size,  0.0f,  0.0f, 0.0f, 1.0f
+	};
+	GLuint pyramid_indices[] = {
+		0, 1, 2, 2, 3, 0,
+		4, 5, 6,
+		7, 8, 9,
+		10, 11, 12,
+		13, 14, 15
+	};
 
-	// Generate and bind EBO
-	glGenBuffers(1, &EBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	// Octahedron touching the bounds at the six face centres, one face per octant
+	float octahedron_vertices[8 * 3 * MeshPool::VERTEX_FLOATS];
+	GLuint octahedron_indices[8 * 3];
+	for (int octant = 0; octant < 8; octant++)
+	{
+		glm::vec3 sign((octant & 1) ? 1.f : -1.f, (octant & 2) ? 1.f : -1.f, (octant & 4) ? 1.f : -1.f);
+		glm::vec3 color = sign * 0.35f + 0.65f;
+		glm::vec3 corners[3] = { {sign.x * size, 0.f, 0.f}, {0.f, sign.y * size, 0.f}, {0.f, 0.f, sign.z * size} };
+		for (int c = 0; c < 3; c++)
+		{
+			float* v = &octahedron_vertices[(octant * 3 + c) * MeshPool::VERTEX_FLOATS];
+			v[0] = corners[c].x; v[1] = corners[c].y; v[2] = corners[c].z;
+			v[3] = color.r; v[4] = color.g; v[5] = color.b;
+			octahedron_indices[octant * 3 + c] = octant * 3 + c;
+		}
+	}
 
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
+	// LOD stand-ins shared by all mesh types: a tetrahedron on alternate
+	// corners of the bounds, and a single point drawn as a point sprite
+	float reduced_vertices[] = {
+		-size, -size, -size,  0.0f, 1.0f, 0.0f,
+		 size,  size, -size,  1.0f, 1.0f, 0.0f,
+		 size, -size,  size,  1.0f, 0.0f, 0.0f,
+		-size,  size,  size,  0.0f, 0.0f, 1.0f
+	};
+	GLuint reduced_indices[] = {
+		0, 1, 2,
+		0, 3, 1,
+		0, 2, 3,
+		1, 3, 2
+	};
+	float point_vertices[] = { 0.0f, 0.0f, 0.0f,  0.6f, 0.6f, 0.6f };
+	GLuint point_indices[] = { 0 };
+
+	// Order must match MeshType
+	meshes = new MeshPool;
+	meshes->add(vertices, 24, indices, 36);
+	meshes->add(pyramid_vertices, 16, pyramid_indices, 18);
+	meshes->add(octahedron_vertices, 24, octahedron_indices, 24);
+	reduced_mesh = meshes->add(reduced_vertices, 4, reduced_indices, 12);
+	point_mesh = meshes->add(point_vertices, 1, point_indices, 1);
+	meshes->upload();
 
-	// Color attribute
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+	// Generate and bind VAO
+	glGenVertexArrays(1, &VAO);
+	gl_state().bind_vertex_array(VAO);
+	meshes->bind_attributes();
+	gl_state().bind_vertex_array(0);
+}
 
-	glBindVertexArray(0);
+void CubeRenderer::draw_model(size_t index) const
+{
+	const MeshRange& mesh = meshes->mesh(index < mesh_ids.size() ? mesh_ids[index] : static_cast<uint8_t>(MESH_CUBE));
+	glDrawElementsBaseVertex(GL_TRIANGLES, mesh.index_count, GL_UNSIGNED_INT,
+		(void*)(mesh.first_index * sizeof(GLuint)), mesh.base_vertex);
 }
 
 void CubeRenderer::set_selection_rectangle(float x, float y, float w, float h)
@@ -260,115 +343,375 @@ void CubeRenderer::set_selection_rectangle(float x, float y, float w, float h)
 
 }
 
-void CubeRenderer::render(const glm::mat4& view, const glm::mat4& projection, const std::vector<glm::mat4>& models, const std::set<int>& selected )
+glm::ivec4 CubeRenderer::get_selection_rectangle() const
 {
+	// At least one pixel, so that a click without drag still picks
+	int width = std::max(1, static_cast<int>(sel_w));
+	int height = std::max(1, static_cast<int>(sel_h));
+	return glm::ivec4(static_cast<int>(sel_x), static_cast<int>(sel_y), width, height);
+}
 
-	glUseProgram(selection_mode ? pickShaderPrg : shaderProgram);
-
-	if(selection_mode)
-		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	// Set view and projection matrices
+glm::ivec4 CubeRenderer::pick_target_rect() const
+{
+	glm::ivec4 rect = get_selection_rectangle();
+	if (pick_region)
+		return glm::ivec4(0, 0, rect.z, rect.w);
+	return rect;
+}
 
-	glUniformMatrix4fv((selection_mode) ? p_viewLoc : viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv((selection_mode) ? p_projectionLoc : projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-	
-	glBindVertexArray(VAO);
+glm::mat4 CubeRenderer::pick_projection(const glm::mat4& projection, const glm::ivec4& viewport) const
+{
+	if (!pick_region)
+		return projection;
+
+	// Same as gluPickMatrix: scale and translate so that only the selection
+	// rectangle ends up inside the clip volume.
+	glm::ivec4 rect = get_selection_rectangle();
+	glm::vec2 center(rect.x + rect.z * 0.5f, rect.y + rect.w * 0.5f);
+	glm::vec2 delta(rect.z, rect.w);
+	return glm::pickMatrix(center, delta, viewport) * projection;
+}
 
-	int model_id = 100;
-	// Render each cube with its model matrix
-	for (const auto& model : models) {
+void CubeRenderer::render(size_t model_count, const ModelMatrices& model_matrices)
+{
+	if (!selection_mode)
+	{
+		selection->resize(model_count);
+		selection->upload();
+	}
 
-		glUniformMatrix4fv((selection_mode) ? p_modelLoc: modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+	bool occlusion_pass = selection_mode && engine == SelectionEngine::OcclusionQuery;
+	if (use_instancing && !occlusion_pass && instanced->model_count() == model_count)
+	{
+		if (selection_mode)
+		{
+			instanced->draw_pick(pick_candidates);
+			pick_candidates = false;
+		}
+		else
+			instanced->draw(hovered_id, *selection);
+	}
+	else
+	{
+		gl_state().use_program(selection_mode ? pickShaderPrg : shaderProgram);
 
-		// Convert "i", the integer mesh ID, into an RGB color
 		if(selection_mode)
+			gl_state().clear_color(glm::vec4(1.0f));
+		// View and projection come from the Frame uniform block
+
+		gl_state().bind_vertex_array(VAO);
+
+		const std::vector<glm::mat4>& models = model_matrices();
+		if (occlusion_pass)
 		{
-			int r = (model_id & 0x000000FF) >> 0;
-			int g = (model_id & 0x0000FF00) >> 8;
-			int b = (model_id & 0x00FF0000) >> 16;
-			// OpenGL expects colors to be in [0,1], so divide by 255.
-			glUniform4f(p_picking_color, r / 255.0f, g / 255.0f, b / 255.0f, 1.0f);
+			occlusion_render(models);
+			selection_mode = false;
+			pick_candidates = false;
+			return;
 		}
 
-		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-		++model_id;
+		int model_id = PICK_FIRST_ID;
+		// Render each model with its matrix and mesh
+		for (size_t i = 0; i < models.size(); i++) {
+
+			glUniformMatrix4fv((selection_mode) ? p_modelLoc: modelLoc, 1, GL_FALSE, glm::value_ptr(models[i]));
+
+			if(selection_mode)
+				glUniform1ui(p_picking_id, model_id);
+			else
+			{
+				glUniform1i(selectedLoc, static_cast<GLuint>(model_id) == hovered_id ? 1 : selection->test(i) ? 2 : 0);
+				glUniform1ui(pickIdLoc, model_id);
+			}
+
+			draw_model(i);
+			++model_id;
+		}
 	}
 
 
 	if(selection_mode)
+	{
+		read_pick_rect(pick_target_rect(), model_count);
+		selection_mode = false;
+	}
+}
+
+void CubeRenderer::read_pick_rect(const glm::ivec4& rect, size_t model_count)
+{
+	int x = rect.x;
+	int y = rect.y;
+	int width = rect.z;
+	int height = rect.w;
+	GLuint max_id = static_cast<GLuint>(PICK_FIRST_ID + model_count);
+
+	if (async_readback)
+	{
+		// No glFinish here: the copy is fenced and resolved in poll_selection().
+		readback->request(x, y, width, height, max_id, timed_callback("pick buffer (async)"));
+	}
+	else
 	{
 		glFlush();
 		glFinish();
 
-		std::set<int> sel_ids;
 		//glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		std::vector<GLuint> pixels = readFrameBufferPixels(x, y, width, height);
+		const std::vector<int>& sel_ids = decoder.decode(pixels.data(), pixels.size(), max_id);
 
-		int width = static_cast<int>(sel_w);
-		int height = static_cast<int>(sel_h);
+		timed_callback("pick buffer")(sel_ids);
+	}
+}
+
+void CubeRenderer::read_selection(size_t model_count)
+{
+	// The IDs cover the whole window, so the rectangle is read where it is
+	read_pick_rect(get_selection_rectangle(), model_count);
+	selection_mode = false;
+}
+
+void CubeRenderer::read_id_image(const IdImageCache::Key& key)
+{
+	bool queued = readback->request_image(0, 0, key.size.x, key.size.y, [this, key](const GLuint* pixels, size_t pixel_count) {
+		if (pixels)
+			id_cache->store(key, pixels, pixel_count);
+		else
+			id_cache->abort_refresh();
+	});
+	if (queued)
+		id_cache->begin_refresh();
+}
+
+void CubeRenderer::read_hover(int x, int y, int width, int height)
+{
+	// Keep the aperture inside the window; near an edge the cursor is off its centre
+	int left = std::clamp(x - HOVER_APERTURE / 2, 0, std::max(0, width - HOVER_APERTURE));
+	int bottom = std::clamp(y - HOVER_APERTURE / 2, 0, std::max(0, height - HOVER_APERTURE));
+	request_hover(left, bottom);
+}
+
+void CubeRenderer::update_instances(const InstancedRenderer::ModelSource& models, const std::vector<uint8_t>& meshes_of_models, uint64_t revision,
+	const std::vector<uint32_t>* visible)
+{
+	if (revision != scene_revision)
+	{
+		mesh_ids = meshes_of_models;
+		scene_revision = revision;
+	}
+	if (use_instancing)
+		instanced->update(models, mesh_ids, visible, revision);
+}
+
+bool CubeRenderer::append_instances(const InstancedRenderer::ModelSource& models, const std::vector<uint8_t>& meshes_of_models,
+	const std::vector<uint32_t>& indices, uint64_t revision)
+{
+	if (!use_instancing || !instanced->append(models, meshes_of_models, indices, revision))
+		return false;
+	mesh_ids = meshes_of_models;
+	scene_revision = revision;
+	return true;
+}
+
+void CubeRenderer::set_lod(bool flag)
+{
+	InstancedRenderer::LodSettings settings;
+	settings.enabled = flag;
+	settings.reduced_mesh = reduced_mesh;
+	settings.point_mesh = point_mesh;
+	// Every mesh fits the cube, so its corner distance bounds them all
+	settings.bound_radius = CUBE_HALF_EXTENT * std::sqrt(3.f);
+	instanced->set_lod(settings);
+}
+
+bool CubeRenderer::get_lod() const
+{
+	return instanced->get_lod().enabled;
+}
+
+void CubeRenderer::set_lod_camera(const glm::mat4& view_projection, const glm::mat4& projection, const glm::ivec4& viewport)
+{
+	instanced->set_lod_camera(view_projection, projection[1][1] * viewport.w * 0.5f);
+}
+
+void CubeRenderer::set_pick_candidates(const InstancedRenderer::ModelSource& models, const std::vector<uint32_t>& candidates)
+{
+	if (!use_instancing)
+		return;
+	instanced->update_candidates(models, mesh_ids, candidates);
+	pick_candidates = true;
+}
+
+void CubeRenderer::poll_selection()
+{
+	readback->poll();
+	occlusion->poll();
+}
 
+bool CubeRenderer::id_cache_needs_refresh(const IdImageCache::Key& key)
+{
+	return use_id_cache && id_cache->needs_refresh(key);
+}
+
+void CubeRenderer::render_id_image(size_t model_count, const ModelMatrices& models, const IdImageCache::Key& key)
+{
+	pick_render(model_count, models);
+	read_id_image(key);
+}
 
-		std::vector<unsigned char> pixels = readFrameBufferPixels(static_cast<int>(sel_x), static_cast<int>(sel_y), width, height);
-		for(size_t i = 0; i < pixels.size()/4; i++)
+bool CubeRenderer::select_from_cache(const IdImageCache::Key& key, size_t model_count)
+{
+	if (!use_id_cache)
+		return false;
+
+	std::vector<int> sel_ids;
+	GLuint max_id = static_cast<GLuint>(PICK_FIRST_ID + model_count);
+	if (!id_cache->query(key, get_selection_rectangle(), max_id, sel_ids))
+		return false;
+
+	timed_callback("id cache")(sel_ids);
+	selection_mode = false;
+	return true;
+}
+
+void CubeRenderer::set_hover_mode(bool flag)
+{
+	hover_mode = flag;
+	if (!hover_mode)
+		hovered_id = PICK_BACKGROUND_ID;
+}
+
+bool CubeRenderer::hover_from_cache(const IdImageCache::Key& key, int x, int y)
+{
+	if (!hover_mode || !use_id_cache)
+		return false;
+	return id_cache->query_point(key, x, y, hovered_id);
+}
+
+void CubeRenderer::render_hover_pick(size_t model_count, const ModelMatrices& models)
+{
+	pick_render(model_count, models);
+	request_hover(0, 0);
+}
+
+void CubeRenderer::request_hover(int x, int y)
+{
+	uint64_t generation = pick_generation;
+	hover_in_flight = readback->request_image(x, y, HOVER_APERTURE, HOVER_APERTURE, [this, generation](const GLuint* pixels, size_t pixel_count) {
+		// Cleared on failure too, or no hover pick would be issued again
+		hover_in_flight = false;
+		if (!hover_mode || !pixels || generation != pick_generation)
+			return;
+
+		// The object closest to the centre of the aperture wins
+		const int center = HOVER_APERTURE / 2;
+		int best_distance = INT_MAX;
+		GLuint best = PICK_BACKGROUND_ID;
+		for (size_t i = 0; i < pixel_count; i++)
 		{
-			int pickedID = pixels [i*4] + pixels[i*4 + 1] * 256 + pixels[ i*4 + 2] * 256 * 256;
-			if (pickedID != 0x00ffffff) {
-				sel_ids.insert(pickedID);
+			int dx = static_cast<int>(i % HOVER_APERTURE) - center;
+			int dy = static_cast<int>(i / HOVER_APERTURE) - center;
+			int distance = dx * dx + dy * dy;
+			if (pixels[i] != PICK_BACKGROUND_ID && pixels[i] < pick_id_end && distance < best_distance)
+			{
+				best_distance = distance;
+				best = pixels[i];
 			}
 		}
+		hovered_id = best;
+	});
+}
 
-		std::ranges::for_each(sel_ids, [](int i) { std::cout << "selected id: " << i << "\n"; });
-		selection_mode = false;
+void CubeRenderer::occlusion_render(const std::vector<glm::mat4>& models)
+{
+	// Pick program, frame uniforms and the scissor of the selection
+	// rectangle are already set up by the caller.
+	auto on_complete = timed_callback("occlusion query");
+
+	// Lay down depth once, without touching the ID attachment
+	gl_state().color_mask(false);
+	for (size_t i = 0; i < models.size(); i++) {
+		glUniformMatrix4fv(p_modelLoc, 1, GL_FALSE, glm::value_ptr(models[i]));
+		draw_model(i);
+	}
+
+	// Re-draw every object against the finished depth buffer; only the
+	// front-most surfaces pass GL_LEQUAL.
+	gl_state().depth_mask(false);
+	gl_state().depth_func(GL_LEQUAL);
+
+	occlusion->begin(models.size());
+	int model_id = PICK_FIRST_ID;
+	for (size_t i = 0; i < models.size(); i++) {
+		glUniformMatrix4fv(p_modelLoc, 1, GL_FALSE, glm::value_ptr(models[i]));
+		occlusion->begin_object(model_id);
+		draw_model(i);
+		occlusion->end_object();
+		++model_id;
 	}
+	occlusion->submit(on_complete);
 
-	glBindVertexArray(0);
+	gl_state().depth_func(GL_LESS);
+	gl_state().depth_mask(true);
+	gl_state().color_mask(true);
 }
 
-void CubeRenderer::pick_render(const glm::mat4& view, const glm::mat4& projection, const std::vector<glm::mat4>& models,
-	const std::set<int>& selected)
+PickReadback::Callback CubeRenderer::timed_callback(const char* engine_name)
 {
+	auto started = std::chrono::steady_clock::now();
+	uint64_t generation = pick_generation;
+	return [this, engine_name, started, generation](const std::vector<int>& decoded) {
+		// Issued before the scene was replaced, the IDs name other objects
+		if (generation != pick_generation)
+			return;
+		std::vector<int> ids;
+		ids.reserve(decoded.size());
+		std::ranges::copy_if(decoded, std::back_inserter(ids), [this](int id) { return static_cast<GLuint>(id) < pick_id_end; });
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - started;
+		std::cout << engine_name << " selection: " << ids.size() << " ids in " << elapsed.count() << " ms\n";
+		if (selection_callback)
+			selection_callback(ids);
+	};
+}
 
-	glUseProgram(pickShaderPrg);
+void CubeRenderer::pick_render(size_t model_count, const ModelMatrices& model_matrices)
+{
+	if (use_instancing && instanced->model_count() == model_count)
+	{
+		instanced->draw_pick(pick_candidates);
+		pick_candidates = false;
+		return;
+	}
 
-	// Set view and projection matrices
-	glUniformMatrix4fv(p_viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(p_projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+	gl_state().use_program(pickShaderPrg);
 
+	// View and projection come from the Frame uniform block
 
-	glBindVertexArray(VAO);
 
-	int model_id = 100;
-	// Render each cube with its model matrix
-	for (const auto& model : models) {
+	gl_state().bind_vertex_array(VAO);
 
+	const std::vector<glm::mat4>& models = model_matrices();
+	int model_id = PICK_FIRST_ID;
+	// Render each model with its matrix and mesh
+	for (size_t i = 0; i < models.size(); i++) {
 
-		// Convert "i", the integer mesh ID, into an RGB color
-		int r = (model_id & 0x000000FF) >> 0;
-		int g = (model_id & 0x0000FF00) >> 8;
-		int b = (model_id & 0x00FF0000) >> 16;
 
-		// OpenGL expects colors to be in [0,1], so divide by 255.
-		glUniform4f(p_picking_color, r / 255.0f, g / 255.0f, b / 255.0f, 1.0f);
+		glUniform1ui(p_picking_id, model_id);
 
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		glUniformMatrix4fv(p_modelLoc, 1, GL_FALSE, glm::value_ptr(models[i]));
+		draw_model(i);
 		++model_id;
 	}
-
-	glBindVertexArray(0);
 }
 
-std::vector<unsigned char> CubeRenderer::readFrameBufferPixels(int x, int y, int width, int height)
+std::vector<GLuint> CubeRenderer::readFrameBufferPixels(int x, int y, int width, int height)
 {
-	// Function to read pixels from the framebuffer
-	GLenum format = GL_RGBA;
-	GLenum type = GL_UNSIGNED_BYTE;
-	int numChannels = 4;
-
-	// Determine the size of each component in bytes
-	int bytesPerComponent = 1;
+	// Function to read object IDs from the R32UI pick attachment
+	GLenum format = GL_RED_INTEGER;
+	GLenum type = GL_UNSIGNED_INT;
 
-	size_t bufferSize = static_cast<size_t>(width) * height * numChannels * bytesPerComponent;
-	std::vector<unsigned char> pixels(bufferSize);
+	size_t bufferSize = static_cast<size_t>(width) * height;
+	std::vector<GLuint> pixels(bufferSize);
 
 	// It's good practice to ensure all pending OpenGL commands are executed
 	// before reading pixels. This can prevent unexpected results, though
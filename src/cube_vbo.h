@@ -1,18 +1,80 @@
 #pragma once
 
-#include <set>
+#include <climits>
+#include <functional>
 #include <glm/glm.hpp>
 
+#include "pick_readback.h"
+#include "occlusion_selector.h"
+#include "id_image_cache.h"
+#include "instanced_renderer.h"
+#include "mesh_pool.h"
+#include "frame_uniforms.h"
+#include "selection_flags.h"
+
+// How the objects inside the selection rectangle are determined.
+enum class SelectionEngine {
+    PickBuffer,      // render IDs into the pick FBO and read the pixels back
+    OcclusionQuery   // depth pre-pass plus one occlusion query per object
+};
+
+// Meshes of the shared MeshPool, all inside the CUBE_HALF_EXTENT bounds so
+// that the CPU pickers can keep treating every object as its box.
+enum MeshType : uint8_t {
+    MESH_CUBE,
+    MESH_PYRAMID,
+    MESH_OCTAHEDRON,
+    MESH_TYPE_COUNT
+};
+
 class CubeRenderer {
+public:
+    // The model matrices, built on the first call. The instanced path draws
+    // without them, so a scene that is only ever drawn instanced never needs them.
+    using ModelMatrices = std::function<const std::vector<glm::mat4>&()>;
+
 private:
-    GLuint VAO, VBO, EBO;
+    GLuint VAO;
+    MeshPool* meshes;
+    std::vector<uint8_t> mesh_ids;  // MeshType per model, cubes if empty
+    int reduced_mesh, point_mesh;   // LOD stand-ins in the pool, after the MeshTypes
+    uint64_t scene_revision = UINT64_MAX;
     GLuint shaderProgram;
     GLuint pickShaderPrg;
-    GLint modelLoc, viewLoc, projectionLoc, selectedLoc;
-    GLint p_modelLoc, p_viewLoc, p_projectionLoc, p_picking_color;
+    GLint modelLoc, selectedLoc, pickIdLoc;
+    GLint p_modelLoc, p_picking_id;
     bool selection_mode;
     float sel_x, sel_y, sel_w, sel_h;
+    bool async_readback = false;
+    bool pick_region = true;
+    PickReadback* readback;
+    PickDecoder decoder;
+    OcclusionSelector* occlusion;
+    SelectionEngine engine = SelectionEngine::PickBuffer;
+    IdImageCache* id_cache;
+    bool use_id_cache = false;
+    bool hover_mode = false;
+    bool hover_in_flight = false;
+    GLuint hovered_id = PICK_BACKGROUND_ID;
+    InstancedRenderer* instanced;
+    bool use_instancing = true;
+    bool pick_candidates = false;
+    SelectionFlags* selection;
+    PickReadback::Callback selection_callback;
+    // Pick results are clipped to the IDs below this one
+    GLuint pick_id_end = UINT_MAX;
+    // Bumped when the IDs start naming other objects; picks carry the
+    // generation they were issued in, and older ones are dropped
+    uint64_t pick_generation = 0;
+
+    // Read the pick IDs in `rect` of the bound read framebuffer and hand them to the selection callback.
+    void read_pick_rect(const glm::ivec4& rect, size_t model_count);
+    // Read the HOVER_APERTURE square at (x, y) of the bound read framebuffer into hovered_id.
+    void request_hover(int x, int y);
 public:
+    // Half the edge length of the cube mesh; models place and orient it.
+    static constexpr float CUBE_HALF_EXTENT = 0.1f;
+
     CubeRenderer();
 
     ~CubeRenderer();
@@ -26,12 +88,134 @@ public:
 
 	void set_section_mode(bool flag) { selection_mode = flag; }
 
+    // Rectangle in window coordinates with a bottom-left origin, as used by glReadPixels.
     void set_selection_rectangle(float x, float y, float w, float h);
+    glm::ivec4 get_selection_rectangle() const;
+
+    // Render the pick pass into an FBO sized to the selection rectangle with a
+    // pick-region projection. When off, the full-window FBO is scissored instead.
+    void set_pick_region_mode(bool flag) { pick_region = flag; }
+    bool get_pick_region_mode() const { return pick_region; }
+
+    // Rectangle of the pick FBO that the pick pass covers and that is read back.
+    glm::ivec4 pick_target_rect() const;
+
+    // Projection that maps the selection rectangle of `viewport` onto the whole pick target.
+    glm::mat4 pick_projection(const glm::mat4& projection, const glm::ivec4& viewport) const;
+
+    // Read the pick FBO through the PBO ring instead of a blocking glReadPixels.
+    void set_async_readback(bool flag) { async_readback = flag; }
+    bool get_async_readback() const { return async_readback; }
+
+    void set_selection_engine(SelectionEngine e) { engine = e; }
+    SelectionEngine get_selection_engine() const { return engine; }
+    OcclusionSelector* get_occlusion_selector() { return occlusion; }
+
+    // Answer picks from a CPU copy of the ID image while the view and scene
+    // are unchanged, refreshing it in the background when they do change.
+    void set_id_cache_mode(bool flag) { use_id_cache = flag; }
+    bool get_id_cache_mode() const { return use_id_cache; }
+    IdImageCache* get_id_cache() { return id_cache; }
+
+    bool id_cache_needs_refresh(const IdImageCache::Key& key);
+
+    // Pick-render the whole window into the bound FBO and read it back into the ID cache.
+    void render_id_image(size_t model_count, const ModelMatrices& models, const IdImageCache::Key& key);
+
+    // Resolve a pending selection from the ID cache. Returns false on a miss,
+    // in which case the selection goes through the pick pass as usual.
+    bool select_from_cache(const IdImageCache::Key& key, size_t model_count);
+
+    // Side of the square pick region used to find the object under the cursor.
+    static constexpr int HOVER_APERTURE = 3;
+
+    // Pre-highlight the object under the cursor.
+    void set_hover_mode(bool flag);
+    bool get_hover_mode() const { return hover_mode; }
+    GLuint get_hovered_id() const { return hovered_id; }
+
+    // Resolve the hovered object from the ID cache. Returns false on a miss.
+    bool hover_from_cache(const IdImageCache::Key& key, int x, int y);
+
+    // Only models [0, count) may be reported by picking, e.g. the resident
+    // part of a scene that is still loading; later IDs are dropped from the
+    // results, also from those of requests issued before the call.
+    void set_pickable_count(size_t count) { pick_id_end = static_cast<GLuint>(PICK_FIRST_ID + count); }
+    // The scene was replaced: picks still in flight report IDs of the old
+    // one, so their results are dropped.
+    void new_pick_generation() { ++pick_generation; hovered_id = PICK_BACKGROUND_ID; }
+
+    // A hover pick can be issued without blocking or stalling the ring.
+    bool can_hover_pick() const { return hover_mode && !hover_in_flight && readback->has_free_slot(); }
+
+    // Pick-render the aperture around the cursor into the bound FBO; the bound
+    // frame uniforms must already map the aperture onto the HOVER_APERTURE sized target.
+    void render_hover_pick(size_t model_count, const ModelMatrices& models);
+
+    // Draw the visual and pick passes with one instanced draw call instead of
+    // one draw per model. The occlusion engine always draws per object.
+    void set_instancing(bool flag) { use_instancing = flag; }
+    bool get_instancing() const { return use_instancing; }
+    InstancedRenderer* get_instanced_renderer() { return instanced; }
+
+    // Hand the current models (matrices or packed instances) and their MeshType
+    // to the renderer; they are only uploaded again when `revision` changes.
+    // With culling, `visible` lists the models to draw and `revision` changes with the list.
+    void update_instances(const InstancedRenderer::ModelSource& models, const std::vector<uint8_t>& meshes_of_models, uint64_t revision,
+        const std::vector<uint32_t>* visible = nullptr);
+
+    // Add the models appended since the last update to the uploaded ones,
+    // `indices` of them, without uploading the rest again. False if the
+    // instanced path cannot; update_instances() then.
+    bool append_instances(const InstancedRenderer::ModelSource& models, const std::vector<uint8_t>& meshes_of_models,
+        const std::vector<uint32_t>& indices, uint64_t revision);
+
+    // Draw far objects of the instanced path with a reduced mesh or as a
+    // single point, chosen by projected size. The pick pass uses the same
+    // levels and point sizes, so a far object still picks as itself.
+    void set_lod(bool flag);
+    bool get_lod() const;
+
+    // Camera the levels are chosen for, before update_instances().
+    void set_lod_camera(const glm::mat4& view_projection, const glm::mat4& projection, const glm::ivec4& viewport);
+
+    // Restrict the next pick pass to these models, e.g. the ones culled against
+    // the sub-frustum of the pick region. Only affects the instanced path.
+    void set_pick_candidates(const InstancedRenderer::ModelSource& models, const std::vector<uint32_t>& candidates);
+
+    // Single-pass mode: the visual pass has written the IDs of the displayed
+    // frame into the bound SceneTarget, so these only read them back.
+    // Resolve the pending selection rectangle.
+    void read_selection(size_t model_count);
+    // Refresh the ID cache from the whole window.
+    void read_id_image(const IdImageCache::Key& key);
+    // Find the hovered object around (x, y) of a width x height window.
+    void read_hover(int x, int y, int width, int height);
+
+    // Per-model selection state drawn by the visual pass; bit i is model i.
+    SelectionFlags* get_selection() { return selection; }
+
+    // Called with the picked IDs once a selection has been resolved.
+    void set_selection_callback(PickReadback::Callback callback) { selection_callback = std::move(callback); }
+
+    // Deliver any asynchronous selection results that have become available.
+    void poll_selection();
+
+    // Both passes take the camera from the Frame uniform block (FrameUniforms)
+    // the caller has bound for the target being rendered.
+    void render(size_t model_count, const ModelMatrices& models);
+
+    void pick_render(size_t model_count, const ModelMatrices& models);
+
+    void occlusion_render(const std::vector<glm::mat4>& models);
 
-    void render(const glm::mat4& view, const glm::mat4& projection, const std::vector<glm::mat4>& models, const std::set<int>& selected);
+    // Per-object draw of model `index` with its mesh; the matrix uniform is set by the caller.
+    void draw_model(size_t index) const;
 
-    void pick_render(const glm::mat4& view, const glm::mat4& projection, const std::vector<glm::mat4>& models, const std::set<int>& selected);
+    // Wraps the selection callback to report how long an engine took from
+    // the pick pass to the delivered result.
+    PickReadback::Callback timed_callback(const char* engine_name);
 
-    std::vector<unsigned char> readFrameBufferPixels(int x, int y, int width, int height);
+    std::vector<GLuint> readFrameBufferPixels(int x, int y, int width, int height);
 
 };
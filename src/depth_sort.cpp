@@ -0,0 +1,96 @@
+#include "depth_sort.h"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+DepthSorter::DepthSorter(ThreadPool* pool)
+	: pool(pool)
+{
+}
+
+template <typename Position>
+void DepthSorter::sort_by(size_t model_count, Position position, const std::vector<uint8_t>& mesh_ids, const glm::mat4& view,
+	std::vector<uint32_t>& indices)
+{
+	size_t count = indices.size();
+	if (count < 2)
+		return;
+
+	keys.resize(count);
+	scratch.resize(count);
+	size_t chunks = ThreadPool::chunk_count(count, CHUNK_SIZE);
+	histograms.resize(chunks * RADIX);
+
+	// Only the depth row of the view matrix is needed; the camera looks down -z
+	glm::vec4 depth_row(-view[0][2], -view[1][2], -view[2][2], -view[3][2]);
+	bool by_mesh = mesh_ids.size() == model_count;
+	pool->parallel_for(count, CHUNK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++)
+		{
+			uint32_t i = indices[k];
+			glm::vec3 center = position(i);
+			float depth = depth_row.x * center.x + depth_row.y * center.y + depth_row.z * center.z + depth_row.w;
+			// Behind the eye counts as nearest
+			uint64_t depth_bits = depth > 0.f ? std::bit_cast<uint32_t>(depth) >> 7 : 0;
+			uint64_t mesh = by_mesh ? mesh_ids[i] : 0;
+			keys[k] = mesh << 56 | depth_bits << 32 | i;
+		}
+	});
+
+	for (int shift = 32; shift < 64; shift += 8)
+	{
+		pool->parallel_for(count, CHUNK_SIZE, [&](size_t begin, size_t end) {
+			size_t* histogram = &histograms[begin / CHUNK_SIZE * RADIX];
+			std::fill(histogram, histogram + RADIX, 0);
+			for (size_t k = begin; k < end; k++)
+				++histogram[(keys[k] >> shift) & (RADIX - 1)];
+		});
+
+		// Turn the counts into scatter offsets, digit-major then chunk order,
+		// so that every chunk writes its own stable slice of each bucket
+		size_t offset = 0;
+		bool uniform = false;
+		for (int digit = 0; digit < RADIX && !uniform; digit++)
+		{
+			size_t bucket_start = offset;
+			for (size_t c = 0; c < chunks; c++)
+			{
+				size_t& counter = histograms[c * RADIX + digit];
+				size_t n = counter;
+				counter = offset;
+				offset += n;
+			}
+			uniform = offset - bucket_start == count;
+		}
+		if (uniform)
+			continue;
+
+		pool->parallel_for(count, CHUNK_SIZE, [&](size_t begin, size_t end) {
+			size_t* cursor = &histograms[begin / CHUNK_SIZE * RADIX];
+			for (size_t k = begin; k < end; k++)
+				scratch[cursor[(keys[k] >> shift) & (RADIX - 1)]++] = keys[k];
+		});
+		std::swap(keys, scratch);
+	}
+
+	pool->parallel_for(count, CHUNK_SIZE, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++)
+			indices[k] = static_cast<uint32_t>(keys[k]);
+	});
+}
+
+void DepthSorter::sort(const std::vector<glm::mat4>& models, const std::vector<uint8_t>& mesh_ids, const glm::mat4& view,
+	std::vector<uint32_t>& indices)
+{
+	sort_by(models.size(), [&](uint32_t i) { return glm::vec3(models[i][3]); }, mesh_ids, view, indices);
+}
+
+void DepthSorter::sort(const SceneStore& scene, const std::vector<uint8_t>& mesh_ids, const glm::mat4& view,
+	std::vector<uint32_t>& indices)
+{
+	const float* x = scene.data(SceneStore::X);
+	const float* y = scene.data(SceneStore::Y);
+	const float* z = scene.data(SceneStore::Z);
+	sort_by(scene.size(), [=](uint32_t i) { return glm::vec3(x[i], y[i], z[i]); }, mesh_ids, view, indices);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "thread_pool.h"
+#include "scene_store.h"
+
+// Orders the visible models front to back so that the depth test rejects
+// hidden fragments early instead of shading them and overdrawing later.
+// Every model gets a 64-bit key: mesh in the top 8 bits, the upper 24 bits of
+// its positive view-space depth (the bit pattern of a positive float sorts
+// like the float) below, and the model index in the low 32 bits. The upper
+// 32 bits are radix-sorted 8 bits per pass; histograms and scatters run per
+// chunk on the thread pool, and a pass whose digit is the same for all keys
+// is skipped. Instances stay grouped by mesh, nearest first within each mesh.
+class DepthSorter {
+public:
+    explicit DepthSorter(ThreadPool* pool);
+
+    // Reorder `indices` (into models) front to back for the camera `view`.
+    // mesh_ids holds the mesh of every model; empty (or stale) means one mesh.
+    void sort(const std::vector<glm::mat4>& models, const std::vector<uint8_t>& mesh_ids, const glm::mat4& view,
+        std::vector<uint32_t>& indices);
+
+    // The same for a store without hierarchy, whose local positions are the
+    // world positions, so no world matrices have to be built for the sort.
+    void sort(const SceneStore& scene, const std::vector<uint8_t>& mesh_ids, const glm::mat4& view,
+        std::vector<uint32_t>& indices);
+
+private:
+    // `position(i)` gives the world position of model i out of `model_count`.
+    template <typename Position>
+    void sort_by(size_t model_count, Position position, const std::vector<uint8_t>& mesh_ids, const glm::mat4& view,
+        std::vector<uint32_t>& indices);
+
+    static constexpr size_t CHUNK_SIZE = 16384;
+    static constexpr int RADIX = 256;
+
+    ThreadPool* pool;
+    std::vector<uint64_t> keys, scratch;
+    std::vector<size_t> histograms;   // RADIX counters per chunk
+};
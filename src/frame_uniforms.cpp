@@ -0,0 +1,53 @@
+#include "frame_uniforms.h"
+
+FrameUniforms::FrameUniforms()
+{
+	// Every slot starts on a valid range offset
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	stride = (sizeof(Block) + alignment - 1) / alignment * alignment;
+
+	glGenBuffers(1, &ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, stride * SLOT_COUNT, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+FrameUniforms::~FrameUniforms()
+{
+	glDeleteBuffers(1, &ubo);
+}
+
+void FrameUniforms::use(Slot slot, const glm::mat4& view, const glm::mat4& projection, const glm::ivec4& viewport)
+{
+	Block& block = blocks[slot];
+	if (!uploaded[slot] || block.view != view || block.projection != projection || block.viewport != glm::vec4(viewport))
+	{
+		block.view = view;
+		block.projection = projection;
+		block.view_projection = projection * view;
+		block.inverse_view_projection = glm::inverse(block.view_projection);
+		block.viewport = glm::vec4(viewport);
+
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, stride * slot, sizeof(Block), &block);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		uploaded[slot] = true;
+	}
+	use(slot);
+}
+
+void FrameUniforms::use(Slot slot)
+{
+	if (bound == slot)
+		return;
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING, ubo, stride * slot, sizeof(Block));
+	bound = slot;
+}
+
+void FrameUniforms::attach(GLuint program)
+{
+	GLuint index = glGetUniformBlockIndex(program, "Frame");
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, index, BINDING);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// GLSL side of FrameUniforms, pasted into every program that needs the camera.
+#define FRAME_UNIFORM_BLOCK                     \
+    "layout (std140) uniform Frame {\n"         \
+    "    mat4 view;\n"                          \
+    "    mat4 projection;\n"                    \
+    "    mat4 viewProjection;\n"                \
+    "    mat4 inverseViewProjection;\n"         \
+    "    vec4 viewport;\n"                      \
+    "};\n"
+
+// Per-frame camera data in one std140 uniform buffer shared by the visual,
+// pick and overlay programs, so the matrices are uploaded once instead of
+// into each program in turn. A frame may render several views (the camera,
+// a pick region, the hover aperture); each has its own slot in the buffer,
+// is uploaded only when it changes, and use() binds its range to BINDING.
+class FrameUniforms {
+public:
+    enum Slot {
+        CAMERA,
+        PICK_REGION,
+        HOVER,
+        SLOT_COUNT
+    };
+
+    static constexpr GLuint BINDING = 0;
+
+    FrameUniforms();
+    ~FrameUniforms();
+
+    FrameUniforms(const FrameUniforms&) = delete;
+    FrameUniforms& operator=(const FrameUniforms&) = delete;
+
+    // Store a view in `slot` and bind it. `viewport` is the one rendered into.
+    void use(Slot slot, const glm::mat4& view, const glm::mat4& projection, const glm::ivec4& viewport);
+
+    // Bind a slot that already holds the right view.
+    void use(Slot slot);
+
+    // Connect the Frame block of `program` to BINDING; programs without it are left alone.
+    static void attach(GLuint program);
+
+private:
+    // std140 layout of the Frame block: four mat4 and a vec4, no padding
+    struct Block {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 view_projection;
+        glm::mat4 inverse_view_projection;
+        glm::vec4 viewport;
+    };
+
+    GLuint ubo;
+    GLsizeiptr stride;
+    Block blocks[SLOT_COUNT];
+    bool uploaded[SLOT_COUNT] = {};
+    int bound = -1;
+};
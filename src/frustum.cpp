@@ -0,0 +1,197 @@
+#include "frustum.h"
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FRUSTUM_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SSE2
+#endif
+
+Frustum Frustum::from_matrix(const glm::mat4& m)
+{
+	// Gribb/Hartmann: combinations of the rows of the matrix
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0;  // left
+	frustum.planes[1] = row3 - row0;  // right
+	frustum.planes[2] = row3 + row1;  // bottom
+	frustum.planes[3] = row3 - row1;  // top
+	frustum.planes[4] = row3 + row2;  // near
+	frustum.planes[5] = row3 - row2;  // far
+
+	for (glm::vec4& plane : frustum.planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+	return frustum;
+}
+
+void OrientedBoxes::assign(const std::vector<glm::mat4>& models, float half_extent)
+{
+	size_t n = models.size();
+	cx.resize(n);
+	cy.resize(n);
+	cz.resize(n);
+	for (auto& k : axis)
+		for (auto& c : k)
+			c.resize(n);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		const glm::mat4& m = models[i];
+		cx[i] = m[3][0];
+		cy[i] = m[3][1];
+		cz[i] = m[3][2];
+		for (int k = 0; k < 3; k++)
+			for (int c = 0; c < 3; c++)
+				axis[k][c][i] = m[k][c] * half_extent;
+	}
+}
+
+void OrientedBoxes::assign(const SceneStore& scene, float half_extent)
+{
+	cx.clear();
+	cy.clear();
+	cz.clear();
+	append(scene, half_extent);
+}
+
+void OrientedBoxes::append(const SceneStore& scene, float half_extent)
+{
+	size_t first = size(), n = scene.size();
+	cx.insert(cx.end(), scene.data(SceneStore::X) + first, scene.data(SceneStore::X) + n);
+	cy.insert(cy.end(), scene.data(SceneStore::Y) + first, scene.data(SceneStore::Y) + n);
+	cz.insert(cz.end(), scene.data(SceneStore::Z) + first, scene.data(SceneStore::Z) + n);
+	for (auto& k : axis)
+		for (auto& c : k)
+			c.resize(n);
+
+	for (size_t i = first; i < n; i++)
+	{
+		glm::mat3 rotation = glm::mat3_cast(scene.orientation(i));
+		float extent = scene.scale(i) * half_extent;
+		for (int k = 0; k < 3; k++)
+			for (int c = 0; c < 3; c++)
+				axis[k][c][i] = rotation[k][c] * extent;
+	}
+}
+
+void boxes_in_frustum(const OrientedBoxes& boxes, const Frustum& frustum, size_t begin, size_t end, std::vector<uint32_t>& inside)
+{
+	// A box is outside as soon as its centre lies further behind one plane
+	// than the box reaches towards it: n.c + w < -(|n.a0| + |n.a1| + |n.a2|)
+	size_t i = begin;
+
+#if defined(FRUSTUM_AVX2)
+	const __m256 abs_mask8 = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(&boxes.cx[i]);
+		__m256 cy = _mm256_loadu_ps(&boxes.cy[i]);
+		__m256 cz = _mm256_loadu_ps(&boxes.cz[i]);
+		__m256 outside = _mm256_setzero_ps();
+
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			__m256 nx = _mm256_set1_ps(plane.x);
+			__m256 ny = _mm256_set1_ps(plane.y);
+			__m256 nz = _mm256_set1_ps(plane.z);
+
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)),
+				_mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(plane.w)));
+
+			__m256 r = _mm256_setzero_ps();
+			for (int k = 0; k < 3; k++)
+			{
+				__m256 dot = _mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(nx, _mm256_loadu_ps(&boxes.axis[k][0][i])),
+					_mm256_mul_ps(ny, _mm256_loadu_ps(&boxes.axis[k][1][i]))),
+					_mm256_mul_ps(nz, _mm256_loadu_ps(&boxes.axis[k][2][i])));
+				r = _mm256_add_ps(r, _mm256_and_ps(dot, abs_mask8));
+			}
+
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(outside);
+		if (mask == 0xff)
+			continue;
+		for (int lane = 0; lane < 8; lane++)
+		{
+			if (!(mask & (1 << lane)))
+				inside.push_back(static_cast<uint32_t>(i + lane));
+		}
+	}
+#endif
+
+#if defined(FRUSTUM_SSE2)
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&boxes.cx[i]);
+		__m128 cy = _mm_loadu_ps(&boxes.cy[i]);
+		__m128 cz = _mm_loadu_ps(&boxes.cz[i]);
+		__m128 outside = _mm_setzero_ps();
+
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			__m128 nx = _mm_set1_ps(plane.x);
+			__m128 ny = _mm_set1_ps(plane.y);
+			__m128 nz = _mm_set1_ps(plane.z);
+
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+				_mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+
+			__m128 r = _mm_setzero_ps();
+			for (int k = 0; k < 3; k++)
+			{
+				__m128 dot = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(nx, _mm_loadu_ps(&boxes.axis[k][0][i])),
+					_mm_mul_ps(ny, _mm_loadu_ps(&boxes.axis[k][1][i]))),
+					_mm_mul_ps(nz, _mm_loadu_ps(&boxes.axis[k][2][i])));
+				r = _mm_add_ps(r, _mm_and_ps(dot, abs_mask));
+			}
+
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		if (mask == 0xf)
+			continue;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if (!(mask & (1 << lane)))
+				inside.push_back(static_cast<uint32_t>(i + lane));
+		}
+	}
+#endif
+
+	for (; i < end; i++)
+	{
+		if (box_in_frustum(boxes, frustum, i))
+			inside.push_back(static_cast<uint32_t>(i));
+	}
+}
+
+bool box_in_frustum(const OrientedBoxes& boxes, const Frustum& frustum, size_t i)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		float d = plane.x * boxes.cx[i] + plane.y * boxes.cy[i] + plane.z * boxes.cz[i] + plane.w;
+		float r = 0.f;
+		for (int k = 0; k < 3; k++)
+			r += std::abs(plane.x * boxes.axis[k][0][i] + plane.y * boxes.axis[k][1][i] + plane.z * boxes.axis[k][2][i]);
+		if (d + r < 0.f)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "scene_store.h"
+
+// Six planes of a view volume, normals pointing inwards and normalised, so
+// that dot(plane.xyz, p) + plane.w is the signed distance of p.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Extract the planes of any (view) projection matrix, e.g. a pick-region
+    // projection times the view for the sub-frustum of a rectangle.
+    static Frustum from_matrix(const glm::mat4& view_projection);
+};
+
+// The scene's oriented boxes in structure-of-arrays layout: the centre and
+// the three half axes (model matrix columns scaled by the half extent).
+// Twelve floats per object instead of a 64 byte matrix, laid out so that
+// SIMD kernels load one component of four objects at once.
+struct OrientedBoxes {
+    std::vector<float> cx, cy, cz;
+    std::vector<float> axis[3][3];  // axis[k][c]: component c of half axis k
+
+    void assign(const std::vector<glm::mat4>& models, float half_extent);
+    // Same boxes from the placement of the objects, without their matrices;
+    // only for a scene without hierarchy.
+    void assign(const SceneStore& scene, float half_extent);
+    // Add the boxes of the objects appended to such a scene since.
+    void append(const SceneStore& scene, float half_extent);
+    size_t size() const { return cx.size(); }
+};
+
+// Append the indices in [begin, end) of the boxes that are inside or
+// intersect the frustum. Conservative: a box near a frustum edge may be kept
+// although it is just outside. Runs eight boxes per step with AVX2 builds,
+// four with SSE.
+void boxes_in_frustum(const OrientedBoxes& boxes, const Frustum& frustum, size_t begin, size_t end, std::vector<uint32_t>& inside);
+
+// Scalar test of a single box, same criterion as boxes_in_frustum().
+bool box_in_frustum(const OrientedBoxes& boxes, const Frustum& frustum, size_t i);
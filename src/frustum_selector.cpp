@@ -0,0 +1,349 @@
+#include "frustum_selector.h"
+#include "pick_readback.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SELECTOR_SSE2
+#endif
+
+namespace {
+	// Clip-space w below which a corner counts as behind the eye
+	constexpr float MIN_W = 1e-5f;
+
+	inline float cross(const glm::vec2& o, const glm::vec2& a, const glm::vec2& b)
+	{
+		return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+	}
+
+	// Counter-clockwise convex hull (monotone chain) of `count` points, with
+	// room for 2 * count vertices in `hull`; returns the vertex count
+	int convex_hull(glm::vec2* points, int count, glm::vec2* hull)
+	{
+		std::sort(points, points + count, [](const glm::vec2& a, const glm::vec2& b) {
+			return a.x < b.x || (a.x == b.x && a.y < b.y);
+		});
+		int k = 0;
+		for (int i = 0; i < count; i++)
+		{
+			while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.f)
+				k--;
+			hull[k++] = points[i];
+		}
+		for (int i = count - 2, lower = k + 1; i >= 0; i--)
+		{
+			while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.f)
+				k--;
+			hull[k++] = points[i];
+		}
+		return std::max(k - 1, 1);
+	}
+
+	// Signed distances of a clip-space point to the near and far planes,
+	// positive inside: -w <= z <= w
+	inline float near_distance(const glm::vec4& p) { return p.z + p.w; }
+	inline float far_distance(const glm::vec4& p) { return p.w - p.z; }
+
+	// The 12 edges of a box, as corner pairs of the c & 1, c & 2, c & 4 numbering
+	constexpr int BOX_EDGES[12][2] = {
+		{0, 1}, {2, 3}, {4, 5}, {6, 7},
+		{0, 2}, {1, 3}, {4, 6}, {5, 7},
+		{0, 4}, {1, 5}, {2, 6}, {3, 7}
+	};
+}
+
+FrustumSelector::FrustumSelector(ThreadPool* pool)
+	: pool(pool)
+{
+}
+
+void FrustumSelector::build(const std::vector<glm::mat4>& models, float half_extent)
+{
+	boxes.assign(models, half_extent);
+}
+
+void FrustumSelector::build(SceneStore& scene, float half_extent)
+{
+	// The stored placement of a child is relative to its parent
+	if (scene.hierarchical())
+		boxes.assign(scene.world_matrices(), half_extent);
+	else
+		boxes.assign(scene, half_extent);
+}
+
+void FrustumSelector::extend(const SceneStore& scene, float half_extent)
+{
+	boxes.append(scene, half_extent);
+}
+
+void FrustumSelector::select(const glm::ivec4& rect, const glm::mat4& view, const glm::mat4& projection, const glm::ivec4& viewport,
+	RectangleSemantics semantics, std::vector<int>& ids)
+{
+	glm::vec2 delta(std::max(rect.z, 1), std::max(rect.w, 1));
+
+	RectangleTest test;
+	test.view_projection = projection * view;
+	test.x0 = 2.f * (rect.x - viewport.x) / viewport.z - 1.f;
+	test.y0 = 2.f * (rect.y - viewport.y) / viewport.w - 1.f;
+	test.x1 = test.x0 + 2.f * delta.x / viewport.z;
+	test.y1 = test.y0 + 2.f * delta.y / viewport.w;
+	test.semantics = semantics;
+
+	size_t count = boxes.size();
+	size_t chunks = ThreadPool::chunk_count(count, CHUNK_SIZE);
+	if (chunk_hits.size() < chunks)
+		chunk_hits.resize(chunks);
+
+	pool->parallel_for(count, CHUNK_SIZE, [&](size_t begin, size_t end) {
+		std::vector<uint32_t>& hits = chunk_hits[begin / CHUNK_SIZE];
+		hits.clear();
+		rectangle_range(test, begin, end, hits);
+	});
+
+	gather(chunks, ids);
+}
+
+void FrustumSelector::select(const Frustum& frustum, std::vector<int>& ids)
+{
+	gather(frustum_chunks(frustum, 0, boxes.size()), ids);
+}
+
+void FrustumSelector::cull(const Frustum& frustum, std::vector<uint32_t>& indices)
+{
+	cull(frustum, 0, boxes.size(), indices);
+}
+
+void FrustumSelector::cull(const Frustum& frustum, size_t first, size_t end, std::vector<uint32_t>& indices)
+{
+	size_t chunks = frustum_chunks(frustum, first, end);
+	indices.clear();
+	for (size_t c = 0; c < chunks; c++)
+		indices.insert(indices.end(), chunk_hits[c].begin(), chunk_hits[c].end());
+}
+
+size_t FrustumSelector::frustum_chunks(const Frustum& frustum, size_t first, size_t end)
+{
+	size_t count = end - first;
+	size_t chunks = ThreadPool::chunk_count(count, CHUNK_SIZE);
+	if (chunk_hits.size() < chunks)
+		chunk_hits.resize(chunks);
+
+	pool->parallel_for(count, CHUNK_SIZE, [&](size_t begin, size_t stop) {
+		std::vector<uint32_t>& hits = chunk_hits[begin / CHUNK_SIZE];
+		hits.clear();
+		boxes_in_frustum(boxes, frustum, first + begin, first + stop, hits);
+	});
+	return chunks;
+}
+
+void FrustumSelector::gather(size_t chunks, std::vector<int>& ids) const
+{
+	// Every chunk wrote its own list; concatenating them in order keeps the
+	// result sorted without any locking
+	ids.clear();
+	for (size_t c = 0; c < chunks; c++)
+	{
+		for (uint32_t index : chunk_hits[c])
+			ids.push_back(PICK_FIRST_ID + static_cast<int>(index));
+	}
+}
+
+bool FrustumSelector::rectangle_exact(const RectangleTest& test, size_t i) const
+{
+	const glm::mat4& vp = test.view_projection;
+	glm::vec4 center = vp * glm::vec4(boxes.cx[i], boxes.cy[i], boxes.cz[i], 1.f);
+	glm::vec4 axis[3];
+	for (int k = 0; k < 3; k++)
+		axis[k] = vp * glm::vec4(boxes.axis[k][0][i], boxes.axis[k][1][i], boxes.axis[k][2][i], 0.f);
+
+	glm::vec4 corners[8];
+	bool clipped = false;
+	for (int c = 0; c < 8; c++)
+	{
+		corners[c] = center
+			+ ((c & 1) ? axis[0] : -axis[0])
+			+ ((c & 2) ? axis[1] : -axis[1])
+			+ ((c & 4) ? axis[2] : -axis[2]);
+		clipped = clipped || near_distance(corners[c]) < 0.f || far_distance(corners[c]) < 0.f || corners[c].w < MIN_W;
+	}
+	// Window selection needs the whole box between the near and far planes
+	if (clipped && test.semantics == RectangleSemantics::Window)
+		return false;
+
+	// Project the part of the box between the planes: the corners inside
+	// and the points where the edges cross a plane
+	glm::vec2 points[32];
+	int count = 0;
+	auto project = [&](const glm::vec4& p) { points[count++] = glm::vec2(p) * (1.f / std::max(p.w, MIN_W)); };
+	for (const glm::vec4& p : corners)
+	{
+		if (near_distance(p) >= 0.f && far_distance(p) >= 0.f)
+			project(p);
+	}
+	if (clipped)
+	{
+		for (const auto& edge : BOX_EDGES)
+		{
+			const glm::vec4& a = corners[edge[0]];
+			const glm::vec4& b = corners[edge[1]];
+			for (auto distance : { near_distance, far_distance })
+			{
+				float da = distance(a), db = distance(b);
+				if ((da < 0.f) == (db < 0.f))
+					continue;
+				glm::vec4 p = glm::mix(a, b, da / (da - db));
+				if (near_distance(p) >= -1e-6f * std::abs(p.w) && far_distance(p) >= -1e-6f * std::abs(p.w))
+					project(p);
+			}
+		}
+	}
+	// Entirely in front of the near or behind the far plane
+	if (count == 0)
+		return false;
+
+	glm::vec2 bmin = points[0], bmax = points[0];
+	for (int k = 1; k < count; k++)
+	{
+		bmin = glm::min(bmin, points[k]);
+		bmax = glm::max(bmax, points[k]);
+	}
+
+	if (test.semantics == RectangleSemantics::Window)
+		return bmin.x >= test.x0 && bmax.x <= test.x1 && bmin.y >= test.y0 && bmax.y <= test.y1;
+
+	// Separating axes: the rectangle's own axes first, then the hull edges
+	if (bmax.x < test.x0 || bmin.x > test.x1 || bmax.y < test.y0 || bmin.y > test.y1)
+		return false;
+
+	glm::vec2 hull[64];
+	int n = convex_hull(points, count, hull);
+	const glm::vec2 rect[4] = { {test.x0, test.y0}, {test.x1, test.y0}, {test.x1, test.y1}, {test.x0, test.y1} };
+	for (int e = 0; e < n; e++)
+	{
+		const glm::vec2& a = hull[e];
+		const glm::vec2& b = hull[(e + 1) % n];
+		bool separated = true;
+		for (const glm::vec2& r : rect)
+		{
+			if (cross(a, b, r) >= 0.f)
+			{
+				separated = false;
+				break;
+			}
+		}
+		if (separated)
+			return false;
+	}
+	return true;
+}
+
+void FrustumSelector::rectangle_range(const RectangleTest& test, size_t begin, size_t end, std::vector<uint32_t>& hits) const
+{
+	size_t i = begin;
+
+#if defined(FRUSTUM_SELECTOR_SSE2)
+	const glm::mat4& vp = test.view_projection;
+	const __m128 x0 = _mm_set1_ps(test.x0), x1 = _mm_set1_ps(test.x1);
+	const __m128 y0 = _mm_set1_ps(test.y0), y1 = _mm_set1_ps(test.y1);
+	const __m128 min_w = _mm_set1_ps(MIN_W);
+	const __m128 zero = _mm_setzero_ps();
+	const bool window = test.semantics == RectangleSemantics::Window;
+
+	// Row r of the view projection applied to four vectors at once
+	auto transform = [&](int r, __m128 x, __m128 y, __m128 z, float w) {
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(vp[0][r]), x), _mm_mul_ps(_mm_set1_ps(vp[1][r]), y)),
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(vp[2][r]), z), _mm_set1_ps(vp[3][r] * w)));
+	};
+
+	for (; simd && i + 4 <= end; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&boxes.cx[i]);
+		__m128 cy = _mm_loadu_ps(&boxes.cy[i]);
+		__m128 cz = _mm_loadu_ps(&boxes.cz[i]);
+
+		// Clip-space x, y, w, z of the centre and of the three half axes; the
+		// corners are centre +- axis0 +- axis1 +- axis2
+		__m128 center[4] = { transform(0, cx, cy, cz, 1.f), transform(1, cx, cy, cz, 1.f), transform(3, cx, cy, cz, 1.f), transform(2, cx, cy, cz, 1.f) };
+		__m128 axis[3][4];
+		for (int k = 0; k < 3; k++)
+		{
+			__m128 ax = _mm_loadu_ps(&boxes.axis[k][0][i]);
+			__m128 ay = _mm_loadu_ps(&boxes.axis[k][1][i]);
+			__m128 az = _mm_loadu_ps(&boxes.axis[k][2][i]);
+			axis[k][0] = transform(0, ax, ay, az, 0.f);
+			axis[k][1] = transform(1, ax, ay, az, 0.f);
+			axis[k][2] = transform(3, ax, ay, az, 0.f);
+			axis[k][3] = transform(2, ax, ay, az, 0.f);
+		}
+
+		// Lanes with a corner outside the near or far plane go to the exact
+		// test, unless all corners are beyond the same plane
+		__m128 clipped = _mm_setzero_ps();
+		__m128 all_near_out = _mm_castsi128_ps(_mm_set1_epi32(-1)), all_far_out = all_near_out;
+		__m128 any_inside = _mm_setzero_ps();
+		__m128 minx = _mm_set1_ps(INFINITY), maxx = _mm_set1_ps(-INFINITY);
+		__m128 miny = _mm_set1_ps(INFINITY), maxy = _mm_set1_ps(-INFINITY);
+		for (int c = 0; c < 8; c++)
+		{
+			__m128 p[4];
+			for (int r = 0; r < 4; r++)
+			{
+				p[r] = center[r];
+				p[r] = (c & 1) ? _mm_add_ps(p[r], axis[0][r]) : _mm_sub_ps(p[r], axis[0][r]);
+				p[r] = (c & 2) ? _mm_add_ps(p[r], axis[1][r]) : _mm_sub_ps(p[r], axis[1][r]);
+				p[r] = (c & 4) ? _mm_add_ps(p[r], axis[2][r]) : _mm_sub_ps(p[r], axis[2][r]);
+			}
+			__m128 near_out = _mm_cmplt_ps(_mm_add_ps(p[3], p[2]), zero);
+			__m128 far_out = _mm_cmplt_ps(_mm_sub_ps(p[2], p[3]), zero);
+			clipped = _mm_or_ps(clipped, _mm_or_ps(_mm_or_ps(near_out, far_out), _mm_cmplt_ps(p[2], min_w)));
+			all_near_out = _mm_and_ps(all_near_out, near_out);
+			all_far_out = _mm_and_ps(all_far_out, far_out);
+
+			__m128 inv_w = _mm_div_ps(_mm_set1_ps(1.f), p[2]);
+			__m128 x = _mm_mul_ps(p[0], inv_w);
+			__m128 y = _mm_mul_ps(p[1], inv_w);
+			minx = _mm_min_ps(minx, x);
+			maxx = _mm_max_ps(maxx, x);
+			miny = _mm_min_ps(miny, y);
+			maxy = _mm_max_ps(maxy, y);
+			any_inside = _mm_or_ps(any_inside, _mm_and_ps(
+				_mm_and_ps(_mm_cmpge_ps(x, x0), _mm_cmple_ps(x, x1)),
+				_mm_and_ps(_mm_cmpge_ps(y, y0), _mm_cmple_ps(y, y1))));
+		}
+
+		__m128 bounds_inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(minx, x0), _mm_cmple_ps(maxx, x1)),
+			_mm_and_ps(_mm_cmpge_ps(miny, y0), _mm_cmple_ps(maxy, y1)));
+		__m128 bounds_apart = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(maxx, x0), _mm_cmpgt_ps(minx, x1)),
+			_mm_or_ps(_mm_cmplt_ps(maxy, y0), _mm_cmpgt_ps(miny, y1)));
+
+		int clipped_mask = _mm_movemask_ps(clipped);
+		int accept, reject;
+		if (window)
+		{
+			// A clipped box is never entirely inside
+			accept = _mm_movemask_ps(bounds_inside) & ~clipped_mask;
+			reject = ~accept & 0xf;
+		}
+		else
+		{
+			accept = _mm_movemask_ps(_mm_or_ps(bounds_inside, any_inside)) & ~clipped_mask;
+			reject = (_mm_movemask_ps(bounds_apart) & ~clipped_mask) | _mm_movemask_ps(_mm_or_ps(all_near_out, all_far_out));
+		}
+
+		for (int lane = 0; lane < 4; lane++)
+		{
+			int bit = 1 << lane;
+			if ((accept & bit) || (!(reject & bit) && rectangle_exact(test, i + lane)))
+				hits.push_back(static_cast<uint32_t>(i + lane));
+		}
+	}
+#endif
+
+	for (; i < end; i++)
+	{
+		if (rectangle_exact(test, i))
+			hits.push_back(static_cast<uint32_t>(i));
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "frustum.h"
+#include "thread_pool.h"
+
+// CAD-style rectangle semantics.
+enum class RectangleSemantics {
+    Window,     // the object lies entirely inside the rectangle
+    Crossing    // any part of the object touches the rectangle
+};
+
+// "Select-through" rubberband selection on the CPU.
+// Every object's oriented box is tested against the rectangle, so all objects
+// in the region are returned whether they are occluded or not. The boxes are
+// kept in SoA form and tested in chunks spread over the thread pool.
+// For the rectangle the eight corners of each box are projected four boxes
+// at a time with SSE; the screen-space bounds decide almost every object and
+// only boxes whose bounds straddle the rectangle edges, or that cross the near
+// or far plane, get the exact test: their part between the planes is
+// projected and its hull tested against the rectangle.
+class FrustumSelector {
+public:
+    explicit FrustumSelector(ThreadPool* pool);
+
+    void build(const std::vector<glm::mat4>& models, float half_extent);
+    // From the placement arrays when the scene is flat, else from the world matrices.
+    void build(SceneStore& scene, float half_extent);
+    // Add the boxes of the objects appended to a flat scene since it was built.
+    void extend(const SceneStore& scene, float half_extent);
+
+    // Pick IDs of all objects inside (Window) or touching (Crossing) the
+    // rectangle (bottom-left origin), sorted. Only the view volume between
+    // the near and far planes counts; Window needs the whole box in it.
+    void select(const glm::ivec4& rect, const glm::mat4& view, const glm::mat4& projection, const glm::ivec4& viewport,
+        RectangleSemantics semantics, std::vector<int>& ids);
+
+    // Pick IDs of all objects intersecting a frustum (conservative), sorted.
+    void select(const Frustum& frustum, std::vector<int>& ids);
+
+    // Same test, but returns model indices: the visible list of a culling
+    // pass, with the camera frustum or the sub-frustum of a pick region.
+    void cull(const Frustum& frustum, std::vector<uint32_t>& indices);
+    // The same for the models [first, end) only.
+    void cull(const Frustum& frustum, size_t first, size_t end, std::vector<uint32_t>& indices);
+
+    // Off sends every box of a rectangle selection through the scalar exact
+    // test instead of the SSE2 bounds; both must give the same result.
+    void set_simd(bool flag) { simd = flag; }
+    bool get_simd() const { return simd; }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 16384;
+
+    // Rectangle in normalised device coordinates plus what is needed to classify against it
+    struct RectangleTest {
+        glm::mat4 view_projection;
+        float x0, y0, x1, y1;
+        RectangleSemantics semantics;
+    };
+
+    void rectangle_range(const RectangleTest& test, size_t begin, size_t end, std::vector<uint32_t>& hits) const;
+    bool rectangle_exact(const RectangleTest& test, size_t i) const;
+    // Run boxes_in_frustum() over the chunks of [first, end), returns the chunk count.
+    size_t frustum_chunks(const Frustum& frustum, size_t first, size_t end);
+    void gather(size_t chunks, std::vector<int>& ids) const;
+
+    ThreadPool* pool;
+    bool simd = true;
+    OrientedBoxes boxes;
+    std::vector<std::vector<uint32_t>> chunk_hits;
+};
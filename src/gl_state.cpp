@@ -0,0 +1,139 @@
+#include "gl_state.h"
+
+GlState& gl_state()
+{
+	static GlState state;
+	return state;
+}
+
+bool GlState::changes(bool differs)
+{
+	if (differs)
+		++frame.issued;
+	else
+		++frame.skipped;
+	return differs;
+}
+
+void GlState::use_program(GLuint new_program)
+{
+	if (changes(new_program != program))
+	{
+		glUseProgram(new_program);
+		program = new_program;
+	}
+}
+
+void GlState::bind_vertex_array(GLuint vao)
+{
+	if (changes(vao != vertex_array))
+	{
+		glBindVertexArray(vao);
+		vertex_array = vao;
+	}
+}
+
+void GlState::clear_color(const glm::vec4& color)
+{
+	if (changes(color != clear))
+	{
+		glClearColor(color.r, color.g, color.b, color.a);
+		clear = color;
+	}
+}
+
+void GlState::set(GLenum capability, bool on)
+{
+	int slot = 0;
+	while (slot < CAPABILITY_COUNT && CAPABILITIES[slot] != capability)
+		slot++;
+
+	if (slot == CAPABILITY_COUNT || changes(capabilities[slot] != static_cast<int8_t>(on)))
+	{
+		if (on)
+			glEnable(capability);
+		else
+			glDisable(capability);
+		if (slot < CAPABILITY_COUNT)
+			capabilities[slot] = on;
+	}
+}
+
+void GlState::blend_func(GLenum source, GLenum destination)
+{
+	if (changes(source != blend_source || destination != blend_destination))
+	{
+		glBlendFunc(source, destination);
+		blend_source = source;
+		blend_destination = destination;
+	}
+}
+
+void GlState::line_width(float width)
+{
+	if (changes(width != line))
+	{
+		glLineWidth(width);
+		line = width;
+	}
+}
+
+void GlState::viewport(const glm::ivec4& rect)
+{
+	if (changes(rect != viewport_rect))
+	{
+		glViewport(rect.x, rect.y, rect.z, rect.w);
+		viewport_rect = rect;
+	}
+}
+
+void GlState::scissor(const glm::ivec4& rect)
+{
+	if (changes(rect != scissor_rect))
+	{
+		glScissor(rect.x, rect.y, rect.z, rect.w);
+		scissor_rect = rect;
+	}
+}
+
+void GlState::depth_mask(bool write)
+{
+	if (changes(depth_write != static_cast<int8_t>(write)))
+	{
+		glDepthMask(write ? GL_TRUE : GL_FALSE);
+		depth_write = write;
+	}
+}
+
+void GlState::depth_func(GLenum func)
+{
+	if (changes(func != depth_test_func))
+	{
+		glDepthFunc(func);
+		depth_test_func = func;
+	}
+}
+
+void GlState::color_mask(bool write)
+{
+	if (changes(color_write != static_cast<int8_t>(write)))
+	{
+		GLboolean value = write ? GL_TRUE : GL_FALSE;
+		glColorMask(value, value, value, value);
+		color_write = write;
+	}
+}
+
+void GlState::invalidate()
+{
+	Counters counted = frame, counted_before = previous;
+	*this = GlState();
+	frame = counted;
+	previous = counted_before;
+}
+
+void GlState::end_frame()
+{
+	previous = frame;
+	frame = Counters();
+}
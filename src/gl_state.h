@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+
+// Shadow copy of the GL state that the application, the cube renderers and
+// the rubberband overlay change every frame. Each setter compares against the
+// value it issued last and drops the call when it would change nothing;
+// issued and dropped calls are counted per frame. The shadow copy is only
+// right while all changes of this state go through here; invalidate()
+// forgets it, e.g. after third-party code touched the context.
+class GlState {
+public:
+    struct Counters {
+        uint32_t issued = 0;
+        uint32_t skipped = 0;
+    };
+
+    void use_program(GLuint program);
+    void bind_vertex_array(GLuint vao);
+    void clear_color(const glm::vec4& color);
+
+    // Only the capabilities listed in CAPABILITIES are tracked; others go straight through.
+    void enable(GLenum capability) { set(capability, true); }
+    void disable(GLenum capability) { set(capability, false); }
+    void set(GLenum capability, bool on);
+
+    void blend_func(GLenum source, GLenum destination);
+    void line_width(float width);
+    void viewport(const glm::ivec4& rect);
+    void scissor(const glm::ivec4& rect);
+    void depth_mask(bool write);
+    void depth_func(GLenum func);
+    void color_mask(bool write);
+
+    void invalidate();
+
+    // Close the counters of the current frame; last_frame() returns them.
+    void end_frame();
+    const Counters& last_frame() const { return previous; }
+
+private:
+    static constexpr GLenum CAPABILITIES[] = { GL_DEPTH_TEST, GL_BLEND, GL_SCISSOR_TEST, GL_CULL_FACE };
+    static constexpr int CAPABILITY_COUNT = sizeof(CAPABILITIES) / sizeof(CAPABILITIES[0]);
+    static constexpr GLuint UNKNOWN = ~0u;
+
+    // Count the call and tell whether it has to be issued.
+    bool changes(bool differs);
+
+    GLuint program = UNKNOWN;
+    GLuint vertex_array = UNKNOWN;
+    glm::vec4 clear = glm::vec4(-1.f);
+    int8_t capabilities[CAPABILITY_COUNT] = { -1, -1, -1, -1 };  // -1 unknown
+    GLenum blend_source = UNKNOWN, blend_destination = UNKNOWN;
+    float line = -1.f;
+    glm::ivec4 viewport_rect = glm::ivec4(-1);
+    glm::ivec4 scissor_rect = glm::ivec4(-1);
+    int8_t depth_write = -1;
+    GLenum depth_test_func = UNKNOWN;
+    int8_t color_write = -1;
+
+    Counters frame;
+    Counters previous;
+};
+
+// The state of the one GL context the application renders with.
+GlState& gl_state();
@@ -0,0 +1,66 @@
+#include "id_image_cache.h"
+#include "pick_readback.h"
+
+#include <algorithm>
+
+bool IdImageCache::needs_refresh(const Key& key)
+{
+	bool settled = key == last_seen;
+	last_seen = key;
+
+	if (refresh_in_flight || valid_for(key))
+		return false;
+	return settled;
+}
+
+void IdImageCache::begin_refresh()
+{
+	refresh_in_flight = true;
+	++stats.refreshes;
+}
+
+void IdImageCache::store(const Key& key, const GLuint* pixels, size_t pixel_count)
+{
+	image.assign(pixels, pixels + pixel_count);
+	image_key = key;
+	valid = pixel_count == static_cast<size_t>(key.size.x) * key.size.y;
+	refresh_in_flight = false;
+}
+
+bool IdImageCache::query(const Key& key, const glm::ivec4& rect, GLuint max_id, std::vector<int>& ids)
+{
+	if (!valid_for(key))
+	{
+		++stats.misses;
+		return false;
+	}
+	++stats.hits;
+
+	// Clip to the image, the rectangle may extend past the window
+	int x0 = std::clamp(rect.x, 0, key.size.x);
+	int y0 = std::clamp(rect.y, 0, key.size.y);
+	int x1 = std::clamp(rect.x + rect.z, 0, key.size.x);
+	int y1 = std::clamp(rect.y + rect.w, 0, key.size.y);
+
+	scratch.clear();
+	for (int y = y0; y < y1; y++)
+	{
+		const GLuint* row = image.data() + static_cast<size_t>(y) * key.size.x;
+		scratch.insert(scratch.end(), row + x0, row + x1);
+	}
+	ids = decoder.decode(scratch.data(), scratch.size(), max_id);
+	return true;
+}
+
+bool IdImageCache::query_point(const Key& key, int x, int y, GLuint& id)
+{
+	// Not counted: hover asks on every cursor move and would drown the picks
+	if (!valid_for(key))
+		return false;
+
+	if (x < 0 || y < 0 || x >= key.size.x || y >= key.size.y)
+		id = PICK_BACKGROUND_ID;
+	else
+		id = image[static_cast<size_t>(y) * key.size.x + x];
+	return true;
+}
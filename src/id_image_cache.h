@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "pick_decode.h"
+
+// CPU copy of the full-window ID image.
+// The image is tagged with the camera matrices, the viewport size and the
+// scene revision it was rendered with. As long as none of them changed, picks
+// are answered from this copy without rendering anything; otherwise the
+// renderer refreshes it in the background through the asynchronous readback.
+class IdImageCache {
+public:
+    struct Key {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::ivec2 size;
+        uint64_t scene_revision;
+
+        bool operator==(const Key& other) const = default;
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t refreshes = 0;
+
+        double hit_rate() const { return hits + misses ? double(hits) / double(hits + misses) : 0.0; }
+    };
+
+    // True if the image was rendered with exactly this key.
+    bool valid_for(const Key& key) const { return valid && key == image_key; }
+
+    // A refresh is worth starting when the key differs from the cached one and
+    // has not changed since the previous frame, i.e. the camera has settled.
+    // Cleared by begin_refresh() until the refresh lands.
+    bool needs_refresh(const Key& key);
+
+    void begin_refresh();
+    // The refresh will not land (failed readback); allow the next one.
+    void abort_refresh() { refresh_in_flight = false; }
+    void store(const Key& key, const GLuint* pixels, size_t pixel_count);
+
+    // Distinct IDs inside a rectangle (bottom-left origin). Counts a hit or a
+    // miss; returns false on a miss and leaves `ids` untouched.
+    bool query(const Key& key, const glm::ivec4& rect, GLuint max_id, std::vector<int>& ids);
+
+    // ID under one pixel, or PICK_BACKGROUND_ID. Returns false on a miss;
+    // unlike query() it counts neither, it serves the hover highlight.
+    bool query_point(const Key& key, int x, int y, GLuint& id);
+
+    const Stats& get_stats() const { return stats; }
+
+private:
+    bool valid = false;
+    bool refresh_in_flight = false;
+    Key image_key{};
+    Key last_seen{};
+    std::vector<GLuint> image;
+    std::vector<GLuint> scratch;
+    PickDecoder decoder;
+    Stats stats;
+};
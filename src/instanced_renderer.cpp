@@ -0,0 +1,496 @@
+#include "instanced_renderer.h"
+#include "cube_vbo.h"
+#include "pick_readback.h"
+#include "frame_uniforms.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+namespace {
+	const char* instanced_vertexSrc = R"(
+#version 330 compatibility
+)" FRAME_UNIFORM_BLOCK R"(
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aColor;
+layout (location = 2) in vec4 aModelRow0;
+layout (location = 3) in vec4 aModelRow1;
+layout (location = 4) in vec4 aModelRow2;
+layout (location = 6) in uint aPickId;
+
+out vec3 vertexColor;
+flat out int selected;
+flat out uint pickId;
+
+uniform uint hoveredId;
+uniform uint firstPickId;
+uniform float boundRadius;
+// One bit per model, 32 models per texel
+uniform usamplerBuffer selectionFlags;
+
+void main()
+{
+    mat4 aModel = transpose(mat4(aModelRow0, aModelRow1, aModelRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+    gl_Position = viewProjection * aModel * vec4(aPos, 1.0);
+    // Only used by the point batch: cover the bounding sphere
+    gl_PointSize = max(1.0, boundRadius * length(aModel[0].xyz) * projection[1][1] * viewport.w / gl_Position.w);
+    vertexColor = aColor;
+    pickId = aPickId;
+    uint index = aPickId - firstPickId;
+    uint flags = texelFetch(selectionFlags, int(index >> 5u)).r;
+    if (aPickId == hoveredId)
+        selected = 1;
+    else
+        selected = ((flags >> (index & 31u)) & 1u) != 0u ? 2 : 0;
+}
+)";
+
+	const char* instanced_fragmentSrc = R"(
+#version 330 compatibility
+in vec3 vertexColor;
+flat in int selected;
+flat in uint pickId;
+// Output 1 only reaches a buffer when drawing into a SceneTarget
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out uint PickId;
+
+void main()
+{
+	PickId = pickId;
+	if(selected == 1)
+	{
+		FragColor = vec4(0.8, 0.8, 0.8, 1.0);
+	}
+	else if(selected == 2)
+	{
+		FragColor = vec4(mix(vertexColor, vec3(1.0, 0.6, 0.1), 0.7), 1.0);
+	}
+	else
+	{
+		FragColor = vec4(vertexColor, 1.0);
+	}
+}
+)";
+
+	const char* instanced_picking_vertexSrc = R"(
+#version 330 compatibility
+)" FRAME_UNIFORM_BLOCK R"(
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec4 aModelRow0;
+layout (location = 3) in vec4 aModelRow1;
+layout (location = 4) in vec4 aModelRow2;
+layout (location = 6) in uint aPickId;
+
+flat out uint pickId;
+
+uniform float boundRadius;
+
+void main()
+{
+	mat4 aModel = transpose(mat4(aModelRow0, aModelRow1, aModelRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+	gl_Position = viewProjection * aModel * vec4(aPos, 1.0);
+	// Same size as in the visual pass, in pixels of the pick target
+	gl_PointSize = max(1.0, boundRadius * length(aModel[0].xyz) * projection[1][1] * viewport.w / gl_Position.w);
+	pickId = aPickId;
+}
+)";
+
+	const char* instanced_picking_fragmentSrc = R"(
+#version 330 compatibility
+flat in uint pickId;
+out uint PickId;
+
+void main()
+{
+	PickId = pickId;
+}
+)";
+
+	// First of the three attribute locations taken by the rows of the per-instance matrix
+	constexpr GLuint MODEL_ATTRIB = 2;
+	constexpr GLuint PICK_ID_ATTRIB = 6;
+}
+
+InstancedRenderer::InstancedRenderer(const MeshPool* meshes)
+	: meshes(meshes)
+{
+	shaderProgram = CubeRenderer::setupShaders(instanced_vertexSrc, instanced_fragmentSrc);
+	hoveredIdLoc = glGetUniformLocation(shaderProgram, "hoveredId");
+	gl_state().use_program(shaderProgram);
+	glUniform1ui(glGetUniformLocation(shaderProgram, "firstPickId"), PICK_FIRST_ID);
+	glUniform1i(glGetUniformLocation(shaderProgram, "selectionFlags"), SelectionFlags::TEXTURE_UNIT);
+
+	pickShaderPrg = CubeRenderer::setupShaders(instanced_picking_vertexSrc, instanced_picking_fragmentSrc);
+	boundRadiusLoc = glGetUniformLocation(shaderProgram, "boundRadius");
+	pickBoundRadiusLoc = glGetUniformLocation(pickShaderPrg, "boundRadius");
+	// Point sizes come from the vertex shaders
+	gl_state().enable(GL_PROGRAM_POINT_SIZE);
+
+	// Base instance inside indirect commands needs both extensions (core in 4.3)
+	multi_draw_indirect = GLAD_GL_ARB_multi_draw_indirect && GLAD_GL_ARB_base_instance && GLAD_GL_ARB_draw_indirect;
+
+	glGenVertexArrays(1, &VAO);
+	gl_state().bind_vertex_array(VAO);
+	meshes->bind_attributes();
+
+	// The matrix rows and the ID advance once per instance
+	for (GLuint row = 0; row < 3; row++)
+	{
+		glEnableVertexAttribArray(MODEL_ATTRIB + row);
+		glVertexAttribDivisor(MODEL_ATTRIB + row, 1);
+	}
+	glEnableVertexAttribArray(PICK_ID_ATTRIB);
+	glVertexAttribDivisor(PICK_ID_ATTRIB, 1);
+	gl_state().bind_vertex_array(0);
+
+	for (InstanceSet* set : { &scene, &candidates })
+	{
+		glGenBuffers(1, &set->vbo);
+		glGenBuffers(1, &set->indirect_buffer);
+		set->source = set->vbo;
+	}
+	stream = new StreamBuffer(GL_ARRAY_BUFFER);
+}
+
+InstancedRenderer::~InstancedRenderer()
+{
+	glDeleteVertexArrays(1, &VAO);
+	for (InstanceSet* set : { &scene, &candidates })
+	{
+		glDeleteBuffers(1, &set->vbo);
+		glDeleteBuffers(1, &set->indirect_buffer);
+	}
+	delete stream;
+	glDeleteProgram(shaderProgram);
+	glDeleteProgram(pickShaderPrg);
+}
+
+void InstancedRenderer::bind_instances(const InstanceSet& set, size_t base)
+{
+	// Attribute pointers are VAO state; the caller has the VAO bound
+	size_t offset = set.offset + base * sizeof(Instance);
+	glBindBuffer(GL_ARRAY_BUFFER, set.source);
+	for (GLuint row = 0; row < 3; row++)
+	{
+		glVertexAttribPointer(MODEL_ATTRIB + row, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+			(void*)(offset + offsetof(Instance, model_rows) + row * sizeof(glm::vec4)));
+	}
+	glVertexAttribIPointer(PICK_ID_ATTRIB, 1, GL_UNSIGNED_INT, sizeof(Instance), (void*)(offset + offsetof(Instance, pick_id)));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstancedRenderer::set_streaming(bool flag)
+{
+	if (flag == streaming)
+		return;
+	streaming = flag;
+	// Back on the static buffer, which may be stale by now
+	if (!streaming)
+	{
+		scene.source = scene.vbo;
+		scene.offset = 0;
+		uploaded_revision = UINT64_MAX;
+	}
+}
+
+void InstancedRenderer::set_lod(const LodSettings& settings)
+{
+	lod = settings;
+	for (GLuint program : { shaderProgram, pickShaderPrg })
+	{
+		gl_state().use_program(program);
+		glUniform1f(program == shaderProgram ? boundRadiusLoc : pickBoundRadiusLoc, lod.bound_radius);
+	}
+	uploaded_revision = UINT64_MAX;
+}
+
+void InstancedRenderer::set_lod_camera(const glm::mat4& view_projection, float pixel_scale)
+{
+	// Clip w of a point is its distance along the view axis (1 for orthographic)
+	clip_w_row = glm::vec4(view_projection[0][3], view_projection[1][3], view_projection[2][3], view_projection[3][3]);
+	lod_pixel_scale = pixel_scale;
+}
+
+uint8_t InstancedRenderer::lod_mesh(const glm::mat4& model, uint8_t mesh) const
+{
+	const glm::vec4& center = model[3];
+	float w = glm::dot(clip_w_row, center);
+	if (w <= 0.f)
+		return mesh;
+
+	float radius = lod.bound_radius * glm::length(glm::vec3(model[0])) * lod_pixel_scale / w;
+	if (radius < lod.point_below)
+		return static_cast<uint8_t>(lod.point_mesh);
+	if (radius < lod.reduced_below)
+		return static_cast<uint8_t>(lod.reduced_mesh);
+	return mesh;
+}
+
+size_t InstancedRenderer::instances_of(const ModelSource& models, const std::vector<uint32_t>* indices)
+{
+	return indices ? indices->size() : models.size();
+}
+
+void InstancedRenderer::fill(InstanceSet& set, Instance* out, const ModelSource& models, const std::vector<uint8_t>& mesh_ids,
+	const std::vector<uint32_t>* indices)
+{
+	size_t n = instances_of(models, indices);
+	auto model_at = [&](size_t k) -> size_t { return indices ? (*indices)[k] : k; };
+
+	// Mesh of every instance, after the LOD choice
+	bool by_mesh = mesh_ids.size() == models.size();
+	instance_mesh.resize(n);
+	for (size_t k = 0; k < n; k++)
+	{
+		size_t i = model_at(k);
+		uint8_t mesh = by_mesh ? mesh_ids[i] : 0;
+		instance_mesh[k] = lod.enabled ? lod_mesh(models.matrix(i), mesh) : mesh;
+	}
+
+	// Counting sort by mesh: count, turn counts into group starts, scatter.
+	// It is stable, so an incoming front-to-back order survives in each group.
+	mesh_cursor.assign(meshes->size(), 0);
+	for (size_t k = 0; k < n; k++)
+		++mesh_cursor[instance_mesh[k]];
+
+	if (lod.enabled)
+	{
+		set.lod_counts[LOD_REDUCED] = mesh_cursor[lod.reduced_mesh];
+		set.lod_counts[LOD_POINT] = mesh_cursor[lod.point_mesh];
+		set.lod_counts[LOD_FULL] = n - set.lod_counts[LOD_REDUCED] - set.lod_counts[LOD_POINT];
+	}
+
+	// Triangle meshes first, then the point batch
+	set.commands.clear();
+	size_t first = 0;
+	auto add_group = [&](size_t m) {
+		size_t instances = mesh_cursor[m];
+		mesh_cursor[m] = first;
+		if (instances == 0)
+			return;
+
+		const MeshRange& mesh = meshes->mesh(m);
+		set.commands.push_back({ static_cast<GLuint>(mesh.index_count), static_cast<GLuint>(instances),
+			mesh.first_index, mesh.base_vertex, static_cast<GLuint>(first) });
+		first += instances;
+	};
+	int point_mesh = lod.enabled ? lod.point_mesh : -1;
+	for (size_t m = 0; m < mesh_cursor.size(); m++)
+	{
+		if (static_cast<int>(m) != point_mesh)
+			add_group(m);
+	}
+	set.triangle_commands = set.commands.size();
+	if (point_mesh >= 0)
+		add_group(point_mesh);
+
+	for (size_t k = 0; k < n; k++)
+	{
+		size_t i = model_at(k);
+		Instance& instance = out[mesh_cursor[instance_mesh[k]]++];
+		if (models.packed)
+			std::memcpy(instance.model_rows, models.packed[i].model_rows, sizeof(instance.model_rows));
+		else
+			SceneStore::pack_3x4((*models.matrices)[i], instance.model_rows);
+		// Numbered here rather than trusted from the packed rows
+		instance.pick_id = static_cast<GLuint>(PICK_FIRST_ID + i);
+	}
+	set.count = n;
+}
+
+void InstancedRenderer::upload_commands(const InstanceSet& set)
+{
+	if (multi_draw_indirect)
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, set.indirect_buffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, set.commands.size() * sizeof(DrawCommand), set.commands.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+}
+
+void InstancedRenderer::upload(InstanceSet& set)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, set.vbo);
+	if (staging.size() > set.capacity)
+	{
+		// Reallocate only when growing, otherwise overwrite in place
+		set.capacity = staging.size();
+		glBufferData(GL_ARRAY_BUFFER, set.capacity * sizeof(Instance), staging.data(), GL_DYNAMIC_DRAW);
+	}
+	else if (!staging.empty())
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, 0, staging.size() * sizeof(Instance), staging.data());
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	set.source = set.vbo;
+	set.offset = 0;
+}
+
+void InstancedRenderer::update(const ModelSource& models, const std::vector<uint8_t>& mesh_ids,
+	const std::vector<uint32_t>* visible, uint64_t revision)
+{
+	if (streaming)
+	{
+		models_uploaded = models.size();
+		scene.count = 0;
+		scene.commands.clear();
+		scene.triangle_commands = 0;
+		size_t n = instances_of(models, visible);
+		if (n == 0)
+			return;
+
+		size_t offset;
+		void* data = stream->map(n * sizeof(Instance), offset);
+		if (!data)
+		{
+			std::cerr << "Failed to map the instance stream buffer." << std::endl;
+			return;
+		}
+		fill(scene, static_cast<Instance*>(data), models, mesh_ids, visible);
+		upload_commands(scene);
+		stream->unmap();
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		scene.source = stream->buffer();
+		scene.offset = offset;
+		return;
+	}
+
+	if (revision == uploaded_revision && models.size() == models_uploaded)
+		return;
+
+	staging.resize(instances_of(models, visible));
+	fill(scene, staging.data(), models, mesh_ids, visible);
+	upload_commands(scene);
+	upload(scene);
+
+	models_uploaded = models.size();
+	uploaded_revision = revision;
+}
+
+bool InstancedRenderer::append(const ModelSource& models, const std::vector<uint8_t>& mesh_ids, const std::vector<uint32_t>& indices,
+	uint64_t revision)
+{
+	if (streaming || uploaded_revision == UINT64_MAX)
+		return false;
+
+	// Group the new instances on their own, then place them after the old ones
+	InstanceSet added;
+	staging.resize(indices.size());
+	fill(added, staging.data(), models, mesh_ids, &indices);
+
+	size_t first = scene.count;
+	size_t total = first + added.count;
+	if (total > scene.capacity)
+	{
+		// The resident instances move on the GPU instead of being uploaded again
+		size_t capacity = std::max(total, scene.capacity * 2);
+		GLuint grown;
+		glGenBuffers(1, &grown);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+		glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(Instance), nullptr, GL_DYNAMIC_DRAW);
+		if (first)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, scene.vbo);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, first * sizeof(Instance));
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &scene.vbo);
+		scene.vbo = scene.source = grown;
+		scene.capacity = capacity;
+	}
+	if (added.count)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, scene.vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(Instance), added.count * sizeof(Instance), staging.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// Triangle groups go before the point batch; a group that continues the
+	// last command of its kind with the same mesh only extends that command
+	for (size_t c = 0; c < added.commands.size(); c++)
+	{
+		DrawCommand command = added.commands[c];
+		command.base_instance += static_cast<GLuint>(first);
+		bool triangles = c < added.triangle_commands;
+		size_t begin = triangles ? 0 : scene.triangle_commands;
+		size_t end = triangles ? scene.triangle_commands : scene.commands.size();
+		if (end > begin)
+		{
+			DrawCommand& last = scene.commands[end - 1];
+			if (last.first_index == command.first_index && last.base_vertex == command.base_vertex
+				&& last.base_instance + last.instance_count == command.base_instance)
+			{
+				last.instance_count += command.instance_count;
+				continue;
+			}
+		}
+		scene.commands.insert(scene.commands.begin() + end, command);
+		if (triangles)
+			++scene.triangle_commands;
+	}
+	upload_commands(scene);
+
+	for (int level = 0; level < LOD_LEVEL_COUNT; level++)
+		scene.lod_counts[level] += added.lod_counts[level];
+	scene.count = total;
+	models_uploaded = models.size();
+	uploaded_revision = revision;
+	return true;
+}
+
+void InstancedRenderer::update_candidates(const ModelSource& models, const std::vector<uint8_t>& mesh_ids,
+	const std::vector<uint32_t>& candidate_indices)
+{
+	staging.resize(candidate_indices.size());
+	fill(candidates, staging.data(), models, mesh_ids, &candidate_indices);
+	upload_commands(candidates);
+	upload(candidates);
+}
+
+void InstancedRenderer::submit(const InstanceSet& set)
+{
+	if (set.commands.empty())
+		return;
+
+	gl_state().bind_vertex_array(VAO);
+	size_t point_commands = set.commands.size() - set.triangle_commands;
+	if (multi_draw_indirect)
+	{
+		bind_instances(set, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, set.indirect_buffer);
+		if (set.triangle_commands)
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, static_cast<GLsizei>(set.triangle_commands), 0);
+		if (point_commands)
+			glMultiDrawElementsIndirect(GL_POINTS, GL_UNSIGNED_INT, (void*)(set.triangle_commands * sizeof(DrawCommand)),
+				static_cast<GLsizei>(point_commands), 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		return;
+	}
+
+	// No base instance: move the instance attributes to each group instead
+	for (size_t c = 0; c < set.commands.size(); c++)
+	{
+		const DrawCommand& command = set.commands[c];
+		bind_instances(set, command.base_instance);
+		glDrawElementsInstancedBaseVertex(c < set.triangle_commands ? GL_TRIANGLES : GL_POINTS, command.count, GL_UNSIGNED_INT,
+			(void*)(command.first_index * sizeof(GLuint)), command.instance_count, command.base_vertex);
+	}
+}
+
+void InstancedRenderer::draw(GLuint hovered_id, const SelectionFlags& selection)
+{
+	gl_state().use_program(shaderProgram);
+	glUniform1ui(hoveredIdLoc, hovered_id);
+	selection.bind();
+	submit(scene);
+}
+
+void InstancedRenderer::draw_pick(bool use_candidates)
+{
+	gl_state().use_program(pickShaderPrg);
+	submit(use_candidates ? candidates : scene);
+}
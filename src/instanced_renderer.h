@@ -0,0 +1,195 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_pool.h"
+#include "stream_buffer.h"
+#include "selection_flags.h"
+#include "scene_store.h"
+
+// Draws the whole scene with one multi-draw call per pass. The instances are
+// grouped by mesh into a per-instance attribute buffer (model matrix rows
+// at locations 2-4, pick ID at 6) and each mesh becomes one indirect command
+// whose base instance points at its group. With ARB_multi_draw_indirect that
+// is a single glMultiDrawElementsIndirect; on plain 3.3, which has no base
+// instance, it is one glDrawElementsInstancedBaseVertex per mesh type.
+// Either way the call count does not depend on the number of objects.
+// With LOD on, small objects are regrouped onto a reduced mesh or a single
+// point before the grouping, so they become further batches of the same
+// buffer; the pick pass draws the same batches and so sees the same shapes.
+class InstancedRenderer {
+public:
+    // Per-instance attributes as they sit in the instance buffer
+    struct Instance {
+        glm::vec4 model_rows[3];   // SceneStore::pack_3x4, 16 bytes less than a mat4
+        GLuint pick_id;
+    };
+
+    // Where the placement of every model comes from: its world matrix, or
+    // instances packed in model order ahead of time (a scene file), which
+    // are copied as they are, so such a scene needs no matrices at all.
+    struct ModelSource {
+        const std::vector<glm::mat4>* matrices = nullptr;
+        const Instance* packed = nullptr;
+        size_t count = 0;
+
+        ModelSource(const std::vector<glm::mat4>& models) : matrices(&models), count(models.size()) {}
+        ModelSource(const Instance* instances, size_t instance_count) : packed(instances), count(instance_count) {}
+
+        size_t size() const { return count; }
+
+        glm::mat4 matrix(size_t i) const
+        {
+            if (matrices)
+                return (*matrices)[i];
+            const glm::vec4* rows = packed[i].model_rows;
+            return glm::transpose(glm::mat4(rows[0], rows[1], rows[2], glm::vec4(0.f, 0.f, 0.f, 1.f)));
+        }
+    };
+
+    enum LodLevel {
+        LOD_FULL,
+        LOD_REDUCED,
+        LOD_POINT,
+        LOD_LEVEL_COUNT
+    };
+
+    // Level of detail by projected size: a model whose bounding sphere has a
+    // radius under `reduced_below` pixels is drawn with `reduced_mesh`, under
+    // `point_below` pixels as one point of `point_mesh` (a single-vertex mesh
+    // of the pool) sized to cover the sphere, never under one pixel.
+    struct LodSettings {
+        bool enabled = false;
+        int reduced_mesh = -1;
+        int point_mesh = -1;
+        float reduced_below = 6.f;
+        float point_below = 1.5f;
+        float bound_radius = 0.f;   // of the meshes at scale 1
+    };
+
+    // Draws meshes out of `meshes`, which must outlive this object.
+    explicit InstancedRenderer(const MeshPool* meshes);
+    ~InstancedRenderer();
+
+    // Upload the model matrices unless `revision` is the one already uploaded.
+    // mesh_ids holds the mesh of every model; empty (or stale) means mesh 0 for all.
+    // `visible` restricts the instances to those models (the culling result),
+    // null draws all; `revision` must change whenever the list does.
+    // In streaming mode they are written to the next StreamBuffer segment every call.
+    void update(const ModelSource& models, const std::vector<uint8_t>& mesh_ids,
+        const std::vector<uint32_t>* visible, uint64_t revision);
+
+    // Add the models appended since the last update() or append(), those in
+    // `indices` (in that order), to the uploaded scene without uploading the
+    // others again; for scenes that arrive in pieces. A full buffer grows by
+    // a copy on the GPU. False, with nothing changed, in streaming mode or
+    // if nothing has been uploaded; update() then.
+    bool append(const ModelSource& models, const std::vector<uint8_t>& mesh_ids, const std::vector<uint32_t>& indices,
+        uint64_t revision);
+
+    // Instances for the next pick pass, usually the models in the sub-frustum of
+    // the pick region. Small, so uploaded on every call.
+    void update_candidates(const ModelSource& models, const std::vector<uint8_t>& mesh_ids,
+        const std::vector<uint32_t>& candidates);
+
+    // Stream the matrices each frame instead of keeping a static copy; for
+    // scenes whose transforms change every frame.
+    void set_streaming(bool flag);
+    bool get_streaming() const { return streaming; }
+    const StreamBuffer::Stats& get_stream_stats() const { return stream->get_stats(); }
+
+    bool uses_multi_draw_indirect() const { return multi_draw_indirect; }
+
+    void set_lod(const LodSettings& settings);
+    const LodSettings& get_lod() const { return lod; }
+
+    // Camera the levels are chosen for; takes effect with the next update().
+    // pixel_scale is projection[1][1] * viewport height / 2.
+    void set_lod_camera(const glm::mat4& view_projection, float pixel_scale);
+
+    // Instances per LodLevel in the last scene update.
+    const size_t* lod_counts() const { return scene.lod_counts; }
+
+    // Number of models of the last update(), to detect a stale upload.
+    size_t model_count() const { return models_uploaded; }
+    size_t instance_count() const { return scene.count; }
+    size_t candidate_count() const { return candidates.count; }
+
+    // Visual pass with the bound FrameUniforms; the instance whose ID equals
+    // `hovered_id` is highlighted, those flagged in `selection` are tinted.
+    void draw(GLuint hovered_id, const SelectionFlags& selection);
+
+    // Pick pass into the bound integer attachment; model i writes PICK_FIRST_ID + i.
+    // Draws the candidate instances instead of the scene ones if `use_candidates`.
+    void draw_pick(bool use_candidates = false);
+
+private:
+    // Layout of GL's DrawElementsIndirectCommand
+    struct DrawCommand {
+        GLuint count;
+        GLuint instance_count;
+        GLuint first_index;
+        GLint base_vertex;
+        GLuint base_instance;
+    };
+
+    // Instances grouped by mesh plus the commands that draw them
+    struct InstanceSet {
+        GLuint vbo = 0;
+        GLuint indirect_buffer = 0;
+        size_t capacity = 0;
+        size_t count = 0;
+        GLuint source = 0;      // buffer the instance attributes read from
+        size_t offset = 0;
+        std::vector<DrawCommand> commands;
+        size_t triangle_commands = 0;   // the rest are drawn as points
+        size_t lod_counts[LOD_LEVEL_COUNT] = {};
+    };
+
+    // Number of instances a fill() of these arguments writes.
+    static size_t instances_of(const ModelSource& models, const std::vector<uint32_t>* indices);
+
+    // Mesh model `i` is drawn with after the LOD choice.
+    uint8_t lod_mesh(const glm::mat4& model, uint8_t mesh) const;
+
+    // Write the instances grouped by mesh and rebuild the draw commands of
+    // `set`, which the caller then uploads.
+    void fill(InstanceSet& set, Instance* out, const ModelSource& models, const std::vector<uint8_t>& mesh_ids,
+        const std::vector<uint32_t>* indices);
+
+    // Upload the draw commands of `set` to its indirect buffer, if used.
+    void upload_commands(const InstanceSet& set);
+
+    // Upload `staging` into the set's own buffer.
+    void upload(InstanceSet& set);
+
+    // Point the instance attributes at the set's source, `base` instances in.
+    void bind_instances(const InstanceSet& set, size_t base);
+
+    // Issue the draw commands of `set` with the current program.
+    void submit(const InstanceSet& set);
+
+    const MeshPool* meshes;
+    GLuint VAO;
+    InstanceSet scene, candidates;
+    StreamBuffer* stream;
+    bool streaming = false;
+    bool multi_draw_indirect;
+    size_t models_uploaded = 0;
+    uint64_t uploaded_revision = UINT64_MAX;
+
+    std::vector<Instance> staging;
+    std::vector<size_t> mesh_cursor;
+    std::vector<uint8_t> instance_mesh;
+
+    LodSettings lod;
+    glm::vec4 clip_w_row = glm::vec4(0.f, 0.f, 0.f, 1.f);
+    float lod_pixel_scale = 1.f;
+
+    GLuint shaderProgram, pickShaderPrg;
+    GLint hoveredIdLoc;
+    GLint boundRadiusLoc, pickBoundRadiusLoc;
+};
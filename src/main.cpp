@@ -1,8 +1,9 @@
 #include "application.h"
 
-int main() {
+int main(int argc, char** argv) {
     // Initialize GLFW
     Application app;
-    app.run();
+    // An optional scene file replaces the generated demo scene
+    app.run(argc > 1 ? argv[1] : nullptr);
     return 0;
 }
@@ -0,0 +1,53 @@
+#include "mesh_pool.h"
+
+MeshPool::MeshPool()
+{
+	glGenBuffers(1, &vbo);
+	glGenBuffers(1, &ebo);
+}
+
+MeshPool::~MeshPool()
+{
+	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &ebo);
+}
+
+int MeshPool::add(const float* mesh_vertices, size_t vertex_count, const GLuint* mesh_indices, size_t index_count)
+{
+	MeshRange range;
+	range.first_index = static_cast<GLuint>(indices.size());
+	range.index_count = static_cast<GLsizei>(index_count);
+	range.base_vertex = static_cast<GLint>(vertices.size() / VERTEX_FLOATS);
+
+	vertices.insert(vertices.end(), mesh_vertices, mesh_vertices + vertex_count * VERTEX_FLOATS);
+	indices.insert(indices.end(), mesh_indices, mesh_indices + index_count);
+	ranges.push_back(range);
+	return static_cast<int>(ranges.size()) - 1;
+}
+
+void MeshPool::upload()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The element binding is VAO state, so go through GL_COPY_WRITE_BUFFER
+	// rather than disturbing whatever VAO happens to be bound
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+	glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void MeshPool::bind_attributes() const
+{
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+	// Position attribute
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	// Color attribute
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <vector>
+
+// Where one mesh lives inside the shared buffers of a MeshPool.
+struct MeshRange {
+    GLuint first_index;
+    GLsizei index_count;
+    GLint base_vertex;
+};
+
+// All meshes of the scene packed into one vertex and one index buffer, so
+// that a single VAO serves every mesh and different meshes can be drawn by
+// one multi-draw call. Vertices are position + colour, six floats each;
+// indices are relative to the mesh's own first vertex.
+class MeshPool {
+public:
+    static constexpr size_t VERTEX_FLOATS = 6;
+
+    MeshPool();
+    ~MeshPool();
+
+    MeshPool(const MeshPool&) = delete;
+    MeshPool& operator=(const MeshPool&) = delete;
+
+    // Append a mesh on the CPU side and return its index; upload() sends it.
+    int add(const float* vertices, size_t vertex_count, const GLuint* indices, size_t index_count);
+
+    // (Re)create the GL buffers from everything added so far.
+    void upload();
+
+    GLuint vertex_buffer() const { return vbo; }
+    GLuint index_buffer() const { return ebo; }
+
+    // Bind both buffers and set attributes 0 (position) and 1 (colour) on the bound VAO.
+    void bind_attributes() const;
+
+    size_t size() const { return ranges.size(); }
+    const MeshRange& mesh(size_t i) const { return ranges[i]; }
+
+private:
+    GLuint vbo = 0, ebo = 0;
+    std::vector<float> vertices;
+    std::vector<GLuint> indices;
+    std::vector<MeshRange> ranges;
+};
@@ -0,0 +1,101 @@
+#include "occlusion_selector.h"
+
+#include <algorithm>
+
+OcclusionSelector::OcclusionSelector()
+{
+}
+
+OcclusionSelector::~OcclusionSelector()
+{
+	for (Batch& batch : in_flight)
+	{
+		glDeleteQueries(static_cast<GLsizei>(batch.queries.size()), batch.queries.data());
+	}
+	glDeleteQueries(static_cast<GLsizei>(recording.queries.size()), recording.queries.data());
+	glDeleteQueries(static_cast<GLsizei>(free_queries.size()), free_queries.data());
+}
+
+GLuint OcclusionSelector::acquire_query()
+{
+	if (free_queries.empty())
+	{
+		// Grow the pool in chunks rather than one name per object
+		size_t grow = std::max<size_t>(64, recording.ids.capacity() - recording.ids.size());
+		free_queries.resize(grow);
+		glGenQueries(static_cast<GLsizei>(grow), free_queries.data());
+	}
+	GLuint query = free_queries.back();
+	free_queries.pop_back();
+	return query;
+}
+
+void OcclusionSelector::begin(size_t object_count)
+{
+	recording.queries.clear();
+	recording.ids.clear();
+	recording.queries.reserve(object_count);
+	recording.ids.reserve(object_count);
+}
+
+void OcclusionSelector::begin_object(int id)
+{
+	GLuint query = acquire_query();
+	recording.queries.push_back(query);
+	recording.ids.push_back(id);
+	glBeginQuery(count_samples ? GL_SAMPLES_PASSED : GL_ANY_SAMPLES_PASSED, query);
+}
+
+void OcclusionSelector::end_object()
+{
+	glEndQuery(count_samples ? GL_SAMPLES_PASSED : GL_ANY_SAMPLES_PASSED);
+}
+
+void OcclusionSelector::submit(Callback on_complete)
+{
+	recording.callback = std::move(on_complete);
+	in_flight.push_back(std::move(recording));
+	recording = Batch();
+
+	// Make sure the queries reach the GPU even if nothing else is drawn
+	glFlush();
+}
+
+void OcclusionSelector::poll()
+{
+	while (!in_flight.empty())
+	{
+		Batch& batch = in_flight.front();
+
+		// GL does not promise that queries complete in order, so every one is
+		// checked; those found available are not asked again next frame
+		for (; batch.available < batch.queries.size(); batch.available++)
+		{
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(batch.queries[batch.available], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				return;
+		}
+
+		// Objects were queried in ID order, so the result is already sorted
+		std::vector<int> ids;
+		coverage.clear();
+		for (size_t i = 0; i < batch.queries.size(); i++)
+		{
+			GLuint samples = 0;
+			glGetQueryObjectuiv(batch.queries[i], GL_QUERY_RESULT, &samples);
+			if (samples)
+			{
+				ids.push_back(batch.ids[i]);
+				coverage.emplace_back(batch.ids[i], samples);
+			}
+		}
+
+		free_queries.insert(free_queries.end(), batch.queries.begin(), batch.queries.end());
+		Callback callback = std::move(batch.callback);
+		in_flight.pop_front();
+
+		if (callback)
+			callback(ids);
+	}
+}
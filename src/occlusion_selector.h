@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "pick_readback.h"
+
+// Selection engine that answers "which objects are visible in the rectangle"
+// with occlusion queries instead of reading the pick image back.
+// The caller lays down depth for the scissored region, then wraps the draw of
+// every object in begin_object()/end_object(). Results are collected in poll()
+// once the GPU has made them available, so submitting never blocks.
+class OcclusionSelector {
+public:
+    using Callback = PickReadback::Callback;
+
+    OcclusionSelector();
+    ~OcclusionSelector();
+
+    // GL_SAMPLES_PASSED instead of GL_ANY_SAMPLES_PASSED, so that the
+    // covered sample count per object is available from last_coverage().
+    void set_count_samples(bool flag) { count_samples = flag; }
+    bool get_count_samples() const { return count_samples; }
+
+    void begin(size_t object_count);
+    void begin_object(int id);
+    void end_object();
+    void submit(Callback on_complete);
+
+    // Resolve submitted batches whose results are available. Never blocks.
+    void poll();
+
+    bool busy() const { return !in_flight.empty(); }
+
+    // Visible objects of the last resolved batch with their sample counts.
+    const std::vector<std::pair<int, GLuint>>& last_coverage() const { return coverage; }
+
+private:
+    struct Batch {
+        std::vector<GLuint> queries;
+        std::vector<int> ids;
+        Callback callback;
+        size_t available = 0;   // leading queries known to have their result
+    };
+
+    GLuint acquire_query();
+
+    bool count_samples = false;
+    Batch recording;
+    std::deque<Batch> in_flight;
+    std::vector<GLuint> free_queries;
+    std::vector<std::pair<int, GLuint>> coverage;
+};
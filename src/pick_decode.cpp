@@ -0,0 +1,98 @@
+#include "pick_decode.h"
+#include "pick_readback.h"
+
+#include <bit>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PICK_DECODE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PICK_DECODE_SSE2
+#endif
+
+inline void PickDecoder::mark(GLuint id)
+{
+	if (id <= limit)
+		bits[id >> 6] |= uint64_t(1) << (id & 63);
+}
+
+const std::vector<int>& PickDecoder::decode(const GLuint* pixels, size_t pixel_count, GLuint max_id)
+{
+	limit = max_id;
+	// The bitset is left cleared by the previous call, only grow it
+	size_t words = (static_cast<size_t>(max_id) >> 6) + 1;
+	if (bits.size() < words)
+		bits.resize(words, 0);
+
+	// The background is never reported, so start with it as the "previous" ID
+	GLuint last = PICK_BACKGROUND_ID;
+	size_t i = 0;
+
+#if defined(PICK_DECODE_AVX2)
+	const __m256i background = _mm256_set1_epi32(static_cast<int>(PICK_BACKGROUND_ID));
+	for (; i + 8 <= pixel_count; i += 8)
+	{
+		__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i));
+		__m256i skip = _mm256_or_si256(_mm256_cmpeq_epi32(block, background),
+			_mm256_cmpeq_epi32(block, _mm256_set1_epi32(static_cast<int>(last))));
+		if (_mm256_movemask_epi8(skip) == -1)
+			continue;
+
+		for (size_t j = i; j < i + 8; j++)
+		{
+			GLuint id = pixels[j];
+			if (id != last && id != PICK_BACKGROUND_ID)
+			{
+				mark(id);
+				last = id;
+			}
+		}
+	}
+#elif defined(PICK_DECODE_SSE2)
+	const __m128i background = _mm_set1_epi32(static_cast<int>(PICK_BACKGROUND_ID));
+	for (; i + 4 <= pixel_count; i += 4)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+		__m128i skip = _mm_or_si128(_mm_cmpeq_epi32(block, background),
+			_mm_cmpeq_epi32(block, _mm_set1_epi32(static_cast<int>(last))));
+		if (_mm_movemask_epi8(skip) == 0xffff)
+			continue;
+
+		for (size_t j = i; j < i + 4; j++)
+		{
+			GLuint id = pixels[j];
+			if (id != last && id != PICK_BACKGROUND_ID)
+			{
+				mark(id);
+				last = id;
+			}
+		}
+	}
+#endif
+
+	// Tail, or the whole image without SIMD support
+	for (; i < pixel_count; i++)
+	{
+		GLuint id = pixels[i];
+		if (id != last && id != PICK_BACKGROUND_ID)
+		{
+			mark(id);
+			last = id;
+		}
+	}
+
+	// Emit in ascending order and clear the bitset for the next call
+	ids.clear();
+	for (size_t w = 0; w < words; w++)
+	{
+		uint64_t word = bits[w];
+		while (word)
+		{
+			ids.push_back(static_cast<int>((w << 6) + std::countr_zero(word)));
+			word &= word - 1;
+		}
+		bits[w] = 0;
+	}
+	return ids;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <vector>
+
+// Turns an R32UI pick image into the sorted list of distinct object IDs.
+// The pixel scan runs 4 (SSE2) or 8 (AVX2) IDs at a time and skips whole
+// blocks that are background or repeat the previous ID, which is what most
+// of a pick image consists of. The remaining IDs are deduplicated in a dense
+// bitset indexed by ID, so there is no allocation per pixel; walking the
+// bitset at the end yields the IDs already sorted.
+class PickDecoder {
+public:
+    // IDs greater than max_id are ignored. The returned vector is reused by
+    // the next call.
+    const std::vector<int>& decode(const GLuint* pixels, size_t pixel_count, GLuint max_id);
+
+private:
+    void mark(GLuint id);
+
+    std::vector<uint64_t> bits;
+    std::vector<int> ids;
+    GLuint limit = 0;
+};
@@ -0,0 +1,128 @@
+#include "pick_readback.h"
+
+#include <iostream>
+
+PickReadback::PickReadback()
+{
+	for (Slot& slot : slots)
+	{
+		glGenBuffers(1, &slot.pbo);
+	}
+}
+
+PickReadback::~PickReadback()
+{
+	for (Slot& slot : slots)
+	{
+		if (slot.fence)
+			glDeleteSync(slot.fence);
+		glDeleteBuffers(1, &slot.pbo);
+	}
+}
+
+PickReadback::Slot* PickReadback::enqueue(int x, int y, int width, int height)
+{
+	Slot& slot = slots[next_slot];
+	if (slot.fence)
+	{
+		std::cerr << "Pick readback ring is full, dropping request." << std::endl;
+		return nullptr;
+	}
+
+	size_t pixel_count = static_cast<size_t>(width) * height;
+	size_t size = pixel_count * sizeof(GLuint);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	if (size > slot.capacity)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		slot.capacity = size;
+	}
+
+	// With a pack buffer bound the last argument is an offset, so this only
+	// enqueues the copy and returns immediately.
+	glReadPixels(x, y, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.pixel_count = pixel_count;
+
+	next_slot = (next_slot + 1) % RING_SIZE;
+	return &slot;
+}
+
+bool PickReadback::request(int x, int y, int width, int height, GLuint max_id, Callback on_complete)
+{
+	Slot* slot = enqueue(x, y, width, height);
+	if (!slot)
+		return false;
+
+	slot->max_id = max_id;
+	slot->callback = std::move(on_complete);
+	slot->image_callback = nullptr;
+	return true;
+}
+
+bool PickReadback::request_image(int x, int y, int width, int height, ImageCallback on_complete)
+{
+	Slot* slot = enqueue(x, y, width, height);
+	if (!slot)
+		return false;
+
+	slot->callback = nullptr;
+	slot->image_callback = std::move(on_complete);
+	return true;
+}
+
+void PickReadback::poll()
+{
+	for (Slot& slot : slots)
+	{
+		if (!slot.fence)
+			continue;
+
+		// Zero timeout: only ask whether the copy is done.
+		GLenum state = glClientWaitSync(slot.fence, 0, 0);
+		if (state == GL_TIMEOUT_EXPIRED)
+			continue;
+
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+
+		void* data = nullptr;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		if (state == GL_WAIT_FAILED)
+			std::cerr << "Pick readback fence wait failed." << std::endl;
+		else if (!(data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.pixel_count * sizeof(GLuint), GL_MAP_READ_BIT)))
+			std::cerr << "Failed to map pick readback buffer." << std::endl;
+
+		// A failed readback is still reported, without pixels or IDs, so
+		// the requester does not wait for it forever
+		const GLuint* pixels = static_cast<const GLuint*>(data);
+		std::vector<int> ids;
+		ImageCallback image_callback = std::move(slot.image_callback);
+		slot.image_callback = nullptr;
+		if (image_callback)
+			image_callback(pixels, pixels ? slot.pixel_count : 0);
+		else if (pixels)
+			ids = decoder.decode(pixels, slot.pixel_count, slot.max_id);
+		if (data)
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		Callback callback = std::move(slot.callback);
+		slot.callback = nullptr;
+		if (callback)
+			callback(ids);
+	}
+}
+
+bool PickReadback::busy() const
+{
+	for (const Slot& slot : slots)
+	{
+		if (slot.fence)
+			return true;
+	}
+	return false;
+}
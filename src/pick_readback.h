@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <functional>
+#include <vector>
+
+#include "pick_decode.h"
+
+// Value of the pick attachment where no object was drawn. Object IDs start
+// above it, so it never collides with a real ID.
+constexpr GLuint PICK_BACKGROUND_ID = 0;
+
+// ID given to the first model; the n-th model is picked as PICK_FIRST_ID + n.
+constexpr int PICK_FIRST_ID = 100;
+
+// Asynchronous readback of the pick FBO.
+// Each request copies the selection region into one of a small ring of
+// GL_PIXEL_PACK_BUFFERs and drops a fence behind the copy. poll() is called
+// once per frame and only maps buffers whose fence has already signalled, so
+// the CPU never waits on the GPU; the decoded IDs are handed to the callback
+// given with the request, typically one or two frames later.
+class PickReadback {
+public:
+    // Receives the distinct picked IDs in ascending order.
+    using Callback = std::function<void(const std::vector<int>&)>;
+
+    // Receives the raw ID image, valid only for the duration of the call;
+    // null with a count of 0 if the readback failed.
+    using ImageCallback = std::function<void(const GLuint* pixels, size_t pixel_count)>;
+
+    static constexpr int RING_SIZE = 3;
+
+    PickReadback();
+    ~PickReadback();
+
+    // Queue a read of the currently bound read framebuffer. max_id is the
+    // largest object ID that can appear in it.
+    // Returns false if every slot of the ring is still in flight.
+    bool request(int x, int y, int width, int height, GLuint max_id, Callback on_complete);
+
+    // Same as request(), but hands over the pixels instead of decoded IDs.
+    bool request_image(int x, int y, int width, int height, ImageCallback on_complete);
+
+    // Resolve all requests whose fence has signalled. Never blocks.
+    void poll();
+
+    bool busy() const;
+
+    // True if the next request would not be dropped.
+    bool has_free_slot() const { return slots[next_slot].fence == nullptr; }
+
+private:
+    struct Slot {
+        GLuint pbo = 0;
+        GLsync fence = nullptr;
+        size_t capacity = 0;
+        size_t pixel_count = 0;
+        GLuint max_id = 0;
+        Callback callback;
+        ImageCallback image_callback;
+    };
+
+    Slot* enqueue(int x, int y, int width, int height);
+
+    PickDecoder decoder;
+    Slot slots[RING_SIZE];
+    int next_slot = 0;
+};
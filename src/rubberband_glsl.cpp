@@ -1,6 +1,7 @@
 
 #include "rubberband_glsl.h"
 #include "glad/glad.h"
+#include "gl_state.h"
 #include <string>
 #include <iostream>
 #include <glm/gtc/type_ptr.hpp>
@@ -44,6 +45,7 @@ void RubberbandSelection::setupShaders() {
 	glAttachShader(shaderProgram, fragmentShader);
 	glLinkProgram(shaderProgram);
 	checkProgramLinking(shaderProgram);
+	FrameUniforms::attach(shaderProgram);
 
 	glDeleteShader(vertexShader);
 	glDeleteShader(fragmentShader);
@@ -53,14 +55,14 @@ void RubberbandSelection::setupBuffers() {
 	glGenVertexArrays(1, &VAO);
 	glGenBuffers(1, &VBO);
 
-	glBindVertexArray(VAO);
+	gl_state().bind_vertex_array(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
 	// Configure vertex attributes (position only)
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 
-	glBindVertexArray(0);
+	gl_state().bind_vertex_array(0);
 }
 
 void RubberbandSelection::checkShaderCompilation(unsigned int shader, const std::string& type) {
@@ -136,15 +138,12 @@ void RubberbandSelection::cancelSelection() {
 void RubberbandSelection::render() {
 	if (!isSelecting) return;
 
-	glUseProgram(shaderProgram);
-
-	// Set up orthographic projection for NDC coordinates
-	glm::mat4 projection = glm::mat4(1.0f);
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+	// The window viewport comes from the Frame block bound by the caller
+	gl_state().use_program(shaderProgram);
 
 	// Enable blending for transparency
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state().enable(GL_BLEND);
+	gl_state().blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	// Render filled rectangle
 	renderFill();
@@ -152,14 +151,14 @@ void RubberbandSelection::render() {
 	// Render border
 	renderBorder();
 
-	glDisable(GL_BLEND);
+	gl_state().disable(GL_BLEND);
 }
 
 void RubberbandSelection::renderFill() {
 	// Generate rectangle vertices for filled area
-	auto vertices = generateRectangleVertices(startPos, currentPos);
+	auto vertices = generateRectangleVertices(ndcToScreen(startPos), ndcToScreen(currentPos));
 
-	glBindVertexArray(VAO);
+	gl_state().bind_vertex_array(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_DYNAMIC_DRAW);
 
@@ -173,7 +172,7 @@ void RubberbandSelection::renderFill() {
 
 void RubberbandSelection::renderBorder() {
 	// Generate border vertices (line loop)
-	auto vertices = generateBorderVertices(startPos, currentPos);
+	auto vertices = generateBorderVertices(ndcToScreen(startPos), ndcToScreen(currentPos));
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_DYNAMIC_DRAW);
@@ -182,14 +181,11 @@ void RubberbandSelection::renderBorder() {
 	glUniform3fv(glGetUniformLocation(shaderProgram, "color"), 1, glm::value_ptr(borderColor));
 	glUniform1f(glGetUniformLocation(shaderProgram, "alpha"), borderAlpha);
 
-	// Set line width
-	glLineWidth(2.0f);
+	// Nothing else draws lines, so the width is left as it is for the next frame
+	gl_state().line_width(2.0f);
 
 	// Draw border as line loop
 	glDrawArrays(GL_LINE_LOOP, 0, 4);
-
-	// Reset line width
-	glLineWidth(1.0f);
 }
 
 glm::vec2 RubberbandSelection::screenToNDC(double screenX, double screenY) {
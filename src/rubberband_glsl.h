@@ -3,17 +3,21 @@
 #include <glm/glm.hpp>
 #include <vector>
 
+#include "frame_uniforms.h"
+
 class RubberbandSelection {
 private:
 	// Shader sources
+	// Vertices are window pixels with a top-left origin, mapped to NDC
+	// through the viewport of the shared Frame block
 	const char* vertexShaderSource = R"(
         #version 330 core
+)" FRAME_UNIFORM_BLOCK R"(
         layout (location = 0) in vec2 aPos;
         
-        uniform mat4 projection;
-        
         void main() {
-            gl_Position = projection * vec4(aPos, 0.0, 1.0);
+            vec2 ndc = vec2(aPos.x / viewport.z * 2.0 - 1.0, 1.0 - aPos.y / viewport.w * 2.0);
+            gl_Position = vec4(ndc, 0.0, 1.0);
         }
     )";
 
@@ -0,0 +1,338 @@
+#include "scene_file.h"
+#include "cube_vbo.h"
+#include "instanced_renderer.h"
+#include "pick_readback.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(SceneFile::Header) == 32 && sizeof(SceneFile::Section) == 24, "scene file structs must not be padded");
+
+namespace {
+
+const char MAGIC[4] = { 'S', 'C', 'N', 'B' };
+const uint32_t NO_PARENT_INDEX = UINT32_MAX;
+const size_t COPY_GRAIN = 1 << 18;
+
+// Map the whole file read-only; null if that fails.
+const char* map_file(const std::string& path, size_t& size)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	LARGE_INTEGER file_size;
+	const char* view = nullptr;
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+	{
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+		{
+			view = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			// The view keeps the mapping and the file alive
+			CloseHandle(mapping);
+		}
+		size = static_cast<size_t>(file_size.QuadPart);
+	}
+	CloseHandle(file);
+	return view;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+	struct stat info;
+	void* view = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		size = static_cast<size_t>(info.st_size);
+		view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		// Read ahead: every byte is about to be copied once, front to back
+		if (view != MAP_FAILED)
+		{
+			madvise(view, size, MADV_SEQUENTIAL);
+			madvise(view, size, MADV_WILLNEED);
+		}
+	}
+	::close(fd);
+	return view == MAP_FAILED ? nullptr : static_cast<const char*>(view);
+#endif
+}
+
+void unmap_file(const char* data, size_t size)
+{
+#ifdef _WIN32
+	(void)size;
+	UnmapViewOfFile(data);
+#else
+	munmap(const_cast<char*>(data), size);
+#endif
+}
+
+uint64_t align_up(uint64_t offset, uint64_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Would SceneStore::add() accept these parents in this order?
+bool breadth_first(const uint32_t* parents, size_t count)
+{
+	size_t parents_end = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (parents[i] == NO_PARENT_INDEX)
+		{
+			if (parents_end > 0)
+				return false;
+		}
+		else
+		{
+			if (parents[i] >= i || parents[i] + 1 < parents_end)
+				return false;
+			parents_end = parents[i] + 1;
+		}
+	}
+	return true;
+}
+
+}
+
+SceneFile::~SceneFile()
+{
+	close();
+}
+
+bool SceneFile::open(const std::string& path)
+{
+	close();
+	data = map_file(path, size);
+	if (!data)
+	{
+		std::cerr << "Cannot map scene file " << path << "." << std::endl;
+		return false;
+	}
+
+	const Header* candidate = reinterpret_cast<const Header*>(data);
+	const char* problem = nullptr;
+	if (size < sizeof(Header) || std::memcmp(candidate->magic, MAGIC, sizeof(MAGIC)) != 0)
+		problem = "not a scene file";
+	else if (candidate->byte_order != BYTE_ORDER_MARK)
+		problem = "stored with a different byte order";
+	else if (candidate->version != VERSION)
+		problem = "of an unsupported version";
+	else if (candidate->file_size != size || candidate->section_count > (size - sizeof(Header)) / sizeof(Section))
+		problem = "truncated";
+	else if (candidate->object_count > size)
+		problem = "inconsistent";   // every object takes at least a byte
+	if (!problem)
+	{
+		const Section* table = reinterpret_cast<const Section*>(data + sizeof(Header));
+		for (uint32_t s = 0; s < candidate->section_count && !problem; s++)
+		{
+			const Section& section = table[s];
+			if (section.offset % ALIGNMENT != 0 || section.offset > size || section.size > size - section.offset)
+				problem = "truncated";
+			// Divided, not multiplied: the count is not trusted and could wrap
+			else if (section.element_size == 0 || section.size % section.element_size != 0
+				|| section.size / section.element_size != candidate->object_count)
+				problem = "inconsistent";
+		}
+	}
+	if (problem)
+	{
+		std::cerr << "Scene file " << path << " is " << problem << "." << std::endl;
+		close();
+		return false;
+	}
+
+	header = candidate;
+	sections = reinterpret_cast<const Section*>(data + sizeof(Header));
+	return true;
+}
+
+void SceneFile::close()
+{
+	if (data)
+		unmap_file(data, size);
+	data = nullptr;
+	size = 0;
+	header = nullptr;
+	sections = nullptr;
+}
+
+const void* SceneFile::section(uint32_t type, size_t element_size) const
+{
+	for (uint32_t s = 0; header && s < header->section_count; s++)
+	{
+		if (sections[s].type == type && sections[s].element_size == element_size)
+			return data + sections[s].offset;
+	}
+	return nullptr;
+}
+
+bool SceneFile::load(SceneStore& scene, std::vector<uint8_t>& mesh_ids, ThreadPool* pool) const
+{
+	size_t count = object_count();
+	const float* components[SceneStore::COMPONENT_COUNT];
+	for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+	{
+		components[c] = static_cast<const float*>(section(c, sizeof(float)));
+		if (!components[c] && count)
+		{
+			std::cerr << "Scene file has no component " << c << "." << std::endl;
+			return false;
+		}
+	}
+	// Mesh IDs index the renderers' mesh tables
+	const uint8_t* meshes = static_cast<const uint8_t*>(section(MESH_IDS, sizeof(uint8_t)));
+	if (meshes && std::any_of(meshes, meshes + count, [](uint8_t mesh) { return mesh >= MESH_TYPE_COUNT; }))
+	{
+		std::cerr << "Scene file has unknown mesh IDs." << std::endl;
+		return false;
+	}
+	const uint32_t* parents = static_cast<const uint32_t*>(section(PARENTS, sizeof(uint32_t)));
+	if (parents && !breadth_first(parents, count))
+	{
+		std::cerr << "Scene file hierarchy is not in breadth-first order." << std::endl;
+		return false;
+	}
+
+	if (parents)
+	{
+		// Hierarchies go through add(), which builds the child ranges
+		scene.clear();
+		scene.reserve(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			glm::vec3 position(components[SceneStore::X][i], components[SceneStore::Y][i], components[SceneStore::Z][i]);
+			glm::quat orientation(components[SceneStore::QW][i], components[SceneStore::QX][i],
+				components[SceneStore::QY][i], components[SceneStore::QZ][i]);
+			scene.add(position, orientation, components[SceneStore::SCALE][i],
+				parents[i] == NO_PARENT_INDEX ? SceneStore::NO_PARENT : parents[i]);
+		}
+	}
+	else
+	{
+		// Flat scenes are straight array copies, in parallel so that the
+		// page faults of the mapping are taken on all cores
+		scene.assign_roots(count);
+		float* targets[SceneStore::COMPONENT_COUNT];
+		for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+			targets[c] = scene.data(static_cast<SceneStore::Component>(c));
+		pool->parallel_for(count, COPY_GRAIN, [&](size_t begin, size_t end) {
+			for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+				std::memcpy(targets[c] + begin, components[c] + begin, (end - begin) * sizeof(float));
+		});
+	}
+
+	if (meshes)
+		mesh_ids.assign(meshes, meshes + count);
+	else
+		mesh_ids.clear();
+	return true;
+}
+
+bool SceneFile::write(const std::string& path, SceneStore& scene, const std::vector<uint8_t>& mesh_ids)
+{
+	using Instance = InstancedRenderer::Instance;
+	size_t count = scene.size();
+	bool with_meshes = mesh_ids.size() == count && count > 0;
+
+	std::vector<Section> table;
+	for (uint32_t c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+		table.push_back({ c, sizeof(float), 0, count * sizeof(float) });
+	if (scene.hierarchical())
+		table.push_back({ PARENTS, sizeof(uint32_t), 0, count * sizeof(uint32_t) });
+	if (with_meshes)
+		table.push_back({ MESH_IDS, sizeof(uint8_t), 0, count });
+	table.push_back({ INSTANCES, sizeof(Instance), 0, count * sizeof(Instance) });
+
+	uint64_t offset = sizeof(Header) + table.size() * sizeof(Section);
+	for (Section& section : table)
+	{
+		section.offset = align_up(offset, ALIGNMENT);
+		offset = section.offset + section.size;
+	}
+
+	Header header;
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.section_count = static_cast<uint32_t>(table.size());
+	header.object_count = count;
+	header.file_size = offset;
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cerr << "Cannot create scene file " << path << "." << std::endl;
+		return false;
+	}
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(Section));
+
+	const char padding[ALIGNMENT] = {};
+	auto write_section = [&](const Section& section, const void* bytes, size_t length) {
+		out.write(padding, static_cast<std::streamsize>(section.offset - static_cast<uint64_t>(out.tellp())));
+		out.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(length));
+	};
+
+	const std::vector<glm::mat4>& world = scene.world_matrices();
+	std::vector<uint32_t> parents;
+	std::vector<Instance> instances;
+	for (const Section& section : table)
+	{
+		if (section.type < SceneStore::COMPONENT_COUNT)
+		{
+			write_section(section, scene.data(static_cast<SceneStore::Component>(section.type)), section.size);
+		}
+		else if (section.type == PARENTS)
+		{
+			parents.resize(count);
+			for (size_t i = 0; i < count; i++)
+				parents[i] = scene.parent(i) == SceneStore::NO_PARENT ? NO_PARENT_INDEX : static_cast<uint32_t>(scene.parent(i));
+			write_section(section, parents.data(), section.size);
+		}
+		else if (section.type == MESH_IDS)
+		{
+			write_section(section, mesh_ids.data(), section.size);
+		}
+		else if (section.type == INSTANCES)
+		{
+			// In blocks, to keep the staging small for big scenes
+			const size_t block = 1 << 16;
+			write_section(section, nullptr, 0);
+			for (size_t begin = 0; begin < count; begin += block)
+			{
+				size_t end = std::min(count, begin + block);
+				instances.resize(end - begin);
+				for (size_t i = begin; i < end; i++)
+				{
+					SceneStore::pack_3x4(world[i], instances[i - begin].model_rows);
+					instances[i - begin].pick_id = static_cast<GLuint>(PICK_FIRST_ID + i);
+				}
+				out.write(reinterpret_cast<const char*>(instances.data()), static_cast<std::streamsize>(instances.size() * sizeof(Instance)));
+			}
+		}
+	}
+	out.flush();
+	if (!out)
+	{
+		std::cerr << "Failed to write scene file " << path << "." << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "scene_store.h"
+#include "thread_pool.h"
+
+// Binary scene file in the writer's byte order, read through a read-only
+// memory mapping. The header's byte order mark guards against files from a
+// machine of the other endianness; they are rejected, not converted.
+// A fixed header is followed by a table of sections, each one array of
+// object_count elements starting at a 64-byte aligned offset:
+//   - the SceneStore components, one float array each (sections 0-7),
+//   - the parent indices (uint32, UINT32_MAX for roots), only for hierarchies,
+//   - the mesh IDs (uint8), only for mixed scenes,
+//   - the world transforms and pick IDs in InstancedRenderer's instance
+//     layout, ready to be copied into an instance buffer as they are.
+// Loading copies the arrays into place instead of parsing anything, so the
+// time is spent reading the file. Readers skip section types they do not
+// know; a different version number is rejected.
+class SceneFile {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    // Types 0-7 are the SceneStore::Component arrays
+    enum SectionType : uint32_t {
+        PARENTS = SceneStore::COMPONENT_COUNT,
+        MESH_IDS,
+        INSTANCES
+    };
+
+    struct Header {
+        char magic[4];          // "SCNB"
+        uint32_t version;
+        uint32_t byte_order;    // BYTE_ORDER_MARK as stored by the writer
+        uint32_t section_count;
+        uint64_t object_count;
+        uint64_t file_size;
+    };
+
+    struct Section {
+        uint32_t type;
+        uint32_t element_size;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    SceneFile() = default;
+    ~SceneFile();
+
+    SceneFile(const SceneFile&) = delete;
+    SceneFile& operator=(const SceneFile&) = delete;
+
+    // Map `path` and check the header and the section table; false with a
+    // message on stderr if it is not a scene file this version can read.
+    bool open(const std::string& path);
+    void close();
+
+    size_t object_count() const { return header ? static_cast<size_t>(header->object_count) : 0; }
+
+    // Start of section `type`, or null if the file has none with that element size.
+    const void* section(uint32_t type, size_t element_size) const;
+
+    // Replace the contents of `scene` and `mesh_ids` by the file's. The store
+    // is left untouched if the file does not describe a valid scene.
+    bool load(SceneStore& scene, std::vector<uint8_t>& mesh_ids, ThreadPool* pool) const;
+
+    // Dump `scene` to `path`, overwriting it.
+    static bool write(const std::string& path, SceneStore& scene, const std::vector<uint8_t>& mesh_ids);
+
+private:
+    static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+    static constexpr uint64_t ALIGNMENT = 64;
+
+    const char* data = nullptr;
+    size_t size = 0;
+    const Header* header = nullptr;
+    const Section* sections = nullptr;
+};
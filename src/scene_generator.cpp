@@ -0,0 +1,209 @@
+#include "scene_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/quaternion.hpp>
+
+namespace {
+
+const size_t GRAIN = 1 << 16;
+
+// Objects per strand of the LongStructures shape, at the cube's edge length apart
+const size_t STRAND_LENGTH = 256;
+const float STRAND_STEP = 0.2f;
+
+// Counter based generator: the i-th value of a stream depends only on the
+// seed and i, so chunks can be filled in any order on any thread.
+struct Random {
+	uint64_t state;
+
+	Random(uint64_t seed, uint64_t index)
+		: state(seed ^ (index * 0x9e3779b97f4a7c15ull))
+	{
+		next();
+	}
+
+	// splitmix64
+	uint64_t next()
+	{
+		uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	// In [0, 1)
+	float uniform() { return static_cast<float>(next() >> 40) * (1.f / 16777216.f); }
+
+	float uniform(float low, float high) { return low + (high - low) * uniform(); }
+
+	// Box-Muller, one of the pair
+	float normal()
+	{
+		float u = std::max(uniform(), 1e-7f);
+		return std::sqrt(-2.f * std::log(u)) * std::cos(6.2831853f * uniform());
+	}
+
+	// Uniformly distributed rotation (Shoemake)
+	glm::quat orientation()
+	{
+		float u = uniform(), a = 6.2831853f * uniform(), b = 6.2831853f * uniform();
+		float s = std::sqrt(1.f - u), t = std::sqrt(u);
+		return glm::quat(t * std::cos(b), s * std::sin(a), s * std::cos(a), t * std::sin(b));
+	}
+
+	glm::vec3 direction()
+	{
+		float z = uniform(-1.f, 1.f), a = 6.2831853f * uniform();
+		float r = std::sqrt(1.f - z * z);
+		return glm::vec3(r * std::cos(a), r * std::sin(a), z);
+	}
+};
+
+// Raw component arrays, object i at index i - first
+struct Output {
+	float* const* c;
+	size_t first;
+
+	void set(size_t i, const glm::vec3& position, const glm::quat& orientation, float scale = 1.f)
+	{
+		size_t k = i - first;
+		c[SceneStore::X][k] = position.x;
+		c[SceneStore::Y][k] = position.y;
+		c[SceneStore::Z][k] = position.z;
+		c[SceneStore::QX][k] = orientation.x;
+		c[SceneStore::QY][k] = orientation.y;
+		c[SceneStore::QZ][k] = orientation.z;
+		c[SceneStore::QW][k] = orientation.w;
+		c[SceneStore::SCALE][k] = scale;
+	}
+};
+
+void generate_grid(const SceneSpec& spec, Output out, size_t begin, size_t end)
+{
+	// Same tilt for every object, first about x, then about the tilted y
+	const glm::quat orientation = glm::angleAxis(glm::radians(30.f), glm::vec3(1.0f, 0.0f, 0.0f))
+		* glm::angleAxis(glm::radians(15.f), glm::vec3(0.0f, 1.0f, 0.0f));
+	size_t side = 1;
+	while (side * side * side < spec.count)
+		side++;
+
+	for (size_t i = begin; i < end; i++)
+	{
+		size_t x = i / (side * side), y = i / side % side, z = i % side;
+		out.set(i, glm::vec3(x, y, z) * spec.spacing, orientation);
+	}
+}
+
+void generate_cloud(const SceneSpec& spec, Output out, size_t begin, size_t end)
+{
+	float edge = spec.spacing * std::cbrt(static_cast<float>(spec.count));
+	for (size_t i = begin; i < end; i++)
+	{
+		Random random(spec.seed, i);
+		glm::vec3 position(random.uniform(), random.uniform(), random.uniform());
+		out.set(i, position * edge, random.orientation());
+	}
+}
+
+void generate_cluster(const SceneSpec& spec, Output out, size_t begin, size_t end)
+{
+	// Most objects within a cube a fifth of the cloud's edge: over a hundred
+	// times its density, so nearly everything overlaps something
+	float sigma = 0.05f * spec.spacing * std::cbrt(static_cast<float>(spec.count));
+	for (size_t i = begin; i < end; i++)
+	{
+		Random random(spec.seed, i);
+		glm::vec3 position(random.normal(), random.normal(), random.normal());
+		out.set(i, position * sigma, random.orientation(), random.uniform(0.5f, 1.5f));
+	}
+}
+
+void generate_strands(const SceneSpec& spec, Output out, size_t begin, size_t end)
+{
+	float edge = spec.spacing * std::cbrt(static_cast<float>(spec.count));
+	for (size_t i = begin; i < end; )
+	{
+		// Strand parameters come from the strand index, so every chunk that
+		// touches a strand rebuilds the same line
+		size_t strand = i / STRAND_LENGTH;
+		size_t strand_end = std::min(end, (strand + 1) * STRAND_LENGTH);
+		Random random(spec.seed, strand);
+		glm::vec3 start = glm::vec3(random.uniform(), random.uniform(), random.uniform()) * edge;
+		glm::vec3 direction = random.direction();
+		// Shortest arc from the x axis onto the strand
+		glm::quat orientation = direction.x > -0.9999f
+			? glm::normalize(glm::quat(1.f + direction.x, 0.f, -direction.z, direction.y))
+			: glm::quat(0.f, 0.f, 1.f, 0.f);
+
+		for (; i < strand_end; i++)
+			out.set(i, start + direction * (STRAND_STEP * static_cast<float>(i % STRAND_LENGTH)), orientation);
+	}
+}
+
+// Every object is the base of an assembly: four parts around it, each
+// carrying two smaller ones. Added level by level, as the store requires.
+void add_assemblies(SceneStore& scene)
+{
+	const glm::quat upright(1.f, 0.f, 0.f, 0.f);
+	size_t roots = scene.size();
+	scene.reserve(roots * 13);
+	for (size_t r = 0; r < roots; r++)
+	{
+		for (int p = 0; p < 4; p++)
+		{
+			float angle = glm::radians(90.f * p);
+			scene.add(glm::vec3(std::cos(angle), 0.f, std::sin(angle)) * 0.3f, upright, 0.5f, r);
+		}
+	}
+	size_t parts_end = scene.size();
+	for (size_t p = roots; p < parts_end; p++)
+	{
+		scene.add(glm::vec3(0.f, 0.25f, 0.f), upright, 0.5f, p);
+		scene.add(glm::vec3(0.f, -0.25f, 0.f), upright, 0.5f, p);
+	}
+}
+
+}
+
+const char* scene_shape_name(SceneShape shape)
+{
+	switch (shape)
+	{
+	case SceneShape::Grid: return "grid";
+	case SceneShape::RandomCloud: return "random cloud";
+	case SceneShape::DenseCluster: return "dense cluster";
+	case SceneShape::LongStructures: return "long structures";
+	default: return "unknown";
+	}
+}
+
+void generate_objects(const SceneSpec& spec, float* const components[SceneStore::COMPONENT_COUNT], size_t begin, size_t end)
+{
+	Output out{ components, begin };
+	switch (spec.shape)
+	{
+	case SceneShape::RandomCloud: generate_cloud(spec, out, begin, end); break;
+	case SceneShape::DenseCluster: generate_cluster(spec, out, begin, end); break;
+	case SceneShape::LongStructures: generate_strands(spec, out, begin, end); break;
+	default: generate_grid(spec, out, begin, end); break;
+	}
+}
+
+void generate_scene(const SceneSpec& spec, SceneStore& scene, ThreadPool* pool)
+{
+	scene.assign_roots(spec.count);
+	float* components[SceneStore::COMPONENT_COUNT];
+	for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+		components[c] = scene.data(static_cast<SceneStore::Component>(c));
+
+	pool->parallel_for(spec.count, GRAIN, [&](size_t begin, size_t end) {
+		float* chunk[SceneStore::COMPONENT_COUNT];
+		for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+			chunk[c] = components[c] + begin;
+		generate_objects(spec, chunk, begin, end);
+	});
+
+	if (spec.assemblies)
+		add_assemblies(scene);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "scene_store.h"
+#include "thread_pool.h"
+
+enum class SceneShape {
+    Grid,            // cubic lattice, all objects tilted alike
+    RandomCloud,     // uniform in a cube of the grid's density, random orientations
+    DenseCluster,    // normally distributed around the origin, heavily overlapping
+    LongStructures,  // rows of touching objects along random directions, like beams
+    SHAPE_COUNT
+};
+
+struct SceneSpec {
+    SceneShape shape = SceneShape::Grid;
+    size_t count = 27;
+    uint64_t seed = 1;
+    float spacing = 1.1f;       // grid step; sets the density of the other shapes too
+    bool assemblies = false;    // give every object four parts with two sub-parts each
+};
+
+const char* scene_shape_name(SceneShape shape);
+
+// Replace the contents of `scene` by the objects described by `spec`. The
+// placement of every object is written straight into the store's arrays on
+// the thread pool. Random values come from a hash of the seed and the object
+// (or strand) index, not from a shared generator, so the same spec gives the
+// same scene whatever the thread count or chunking.
+void generate_scene(const SceneSpec& spec, SceneStore& scene, ThreadPool* pool);
+
+// Objects [begin, end) of the scene, without the assemblies: component c of
+// object i goes to components[c][i - begin]. For building the scene a piece
+// at a time; the pieces equal the matching range of generate_scene().
+void generate_objects(const SceneSpec& spec, float* const components[SceneStore::COMPONENT_COUNT], size_t begin, size_t end);
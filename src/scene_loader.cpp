@@ -0,0 +1,166 @@
+#include "scene_loader.h"
+#include "pick_readback.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+SceneLoader::~SceneLoader()
+{
+	cancel();
+}
+
+SceneLoader::FileStart SceneLoader::start(SceneFile* scene_file, SceneStore& scene, size_t budget)
+{
+	cancel();
+	if (scene_file->section(SceneFile::PARENTS, sizeof(uint32_t)) || scene_file->section(SceneFile::MESH_IDS, sizeof(uint8_t)))
+		return FileStart::AtOnce;
+	for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+	{
+		if (scene_file->object_count() && !scene_file->section(c, sizeof(float)))
+		{
+			std::cerr << "Scene file has no component " << c << "." << std::endl;
+			return FileStart::Invalid;
+		}
+	}
+	file = scene_file;
+	begin(file->object_count(), budget, scene);
+	return FileStart::Streaming;
+}
+
+bool SceneLoader::start(const SceneSpec& scene_spec, SceneStore& scene, size_t budget)
+{
+	cancel();
+	if (scene_spec.assemblies)
+		return false;
+	spec = scene_spec;
+	begin(spec.count, budget, scene);
+	return true;
+}
+
+void SceneLoader::begin(size_t count, size_t budget, SceneStore& scene)
+{
+	scene.clear();
+	scene.reserve(count);
+	// Left uninitialised, the worker writes every instance before it is handed over
+	packed = new InstancedRenderer::Instance[count];
+	budget_objects = std::max<size_t>(budget / sizeof(InstancedRenderer::Instance), 1);
+	chunk_objects = std::min(CHUNK_OBJECTS, budget_objects);
+	total_objects = count;
+	resident_objects = 0;
+	stopping = false;
+	worker = std::thread(&SceneLoader::worker_loop, this);
+}
+
+void SceneLoader::cancel()
+{
+	if (worker.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		space.notify_all();
+		worker.join();
+	}
+	ready.clear();
+	delete file;
+	file = nullptr;
+	delete[] packed;
+	packed = nullptr;
+	total_objects = resident_objects = 0;
+}
+
+void SceneLoader::worker_loop()
+{
+	for (size_t first = 0; first < total_objects; first += chunk_objects)
+	{
+		Chunk chunk;
+		chunk.first = first;
+		chunk.count = std::min(chunk_objects, total_objects - first);
+		decode(chunk);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		space.wait(lock, [this] { return stopping || ready.size() < QUEUE_DEPTH; });
+		if (stopping)
+			return;
+		ready.push_back(std::move(chunk));
+	}
+}
+
+void SceneLoader::decode(Chunk& chunk)
+{
+	using Instance = InstancedRenderer::Instance;
+	float* components[SceneStore::COMPONENT_COUNT];
+	for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+	{
+		chunk.components[c].resize(chunk.count);
+		components[c] = chunk.components[c].data();
+	}
+	Instance* instances = packed + chunk.first;
+
+	if (!file)
+	{
+		generate_objects(spec, components, chunk.first, chunk.first + chunk.count);
+	}
+	else
+	{
+		// Touching the mapping here is what reads the file, off the render thread
+		for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+			std::memcpy(components[c], static_cast<const float*>(file->section(c, sizeof(float))) + chunk.first, chunk.count * sizeof(float));
+		auto packed_rows = static_cast<const Instance*>(file->section(SceneFile::INSTANCES, sizeof(Instance)));
+		if (packed_rows)
+		{
+			std::memcpy(instances, packed_rows + chunk.first, chunk.count * sizeof(Instance));
+			return;
+		}
+	}
+
+	// The scene is flat, so the world matrices are the local ones
+	for (size_t k = 0; k < chunk.count; k++)
+	{
+		glm::vec3 position(components[SceneStore::X][k], components[SceneStore::Y][k], components[SceneStore::Z][k]);
+		glm::quat orientation(components[SceneStore::QW][k], components[SceneStore::QX][k],
+			components[SceneStore::QY][k], components[SceneStore::QZ][k]);
+		SceneStore::pack_3x4(SceneStore::compose(position, orientation, components[SceneStore::SCALE][k]), instances[k].model_rows);
+		instances[k].pick_id = static_cast<GLuint>(PICK_FIRST_ID + chunk.first + k);
+	}
+}
+
+size_t SceneLoader::update(SceneStore& scene)
+{
+	size_t completed = 0;
+	while (loading())
+	{
+		Chunk* chunk;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (ready.empty())
+				break;
+			chunk = &ready.front();
+		}
+		// A chunk never exceeds the budget on its own, so one always fits a frame
+		if (completed + chunk->count > budget_objects)
+			break;
+
+		size_t first = scene.append_roots(chunk->count);
+		for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+			std::memcpy(scene.data(static_cast<SceneStore::Component>(c)) + first, chunk->components[c].data(), chunk->count * sizeof(float));
+		resident_objects += chunk->count;
+		completed += chunk->count;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ready.pop_front();
+		}
+		space.notify_one();
+	}
+
+	if (!loading() && worker.joinable())
+	{
+		// Everything was queued, so the worker has finished
+		worker.join();
+		delete file;
+		file = nullptr;
+	}
+	return completed;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "instanced_renderer.h"
+#include "scene_file.h"
+#include "scene_generator.h"
+#include "scene_store.h"
+
+// Builds a flat scene over many frames instead of before the first one. A
+// worker thread decodes chunks of objects, from a scene file or a SceneSpec,
+// up to QUEUE_DEPTH chunks ahead of the render thread: their placements for
+// the store, and their packed instances into an array for the whole scene.
+// A load has an upload budget of instance bytes per frame. No chunk holds
+// more instances than that, and update() only hands over the whole chunks
+// that fit, so a caller that uploads just the new instances of each frame
+// stays within the budget. Nothing pickable is ever half loaded.
+class SceneLoader {
+public:
+    static constexpr size_t CHUNK_OBJECTS = size_t(1) << 16;   // fewer if the budget is smaller
+    static constexpr size_t QUEUE_DEPTH = 8;
+
+    // What start() made of a scene file
+    enum class FileStart {
+        Streaming,  // the loader has taken the file over
+        AtOnce,     // a hierarchy or mixed meshes, for SceneFile::load()
+        Invalid     // not a scene, with a message on stderr
+    };
+
+    SceneLoader() = default;
+    ~SceneLoader();
+
+    SceneLoader(const SceneLoader&) = delete;
+    SceneLoader& operator=(const SceneLoader&) = delete;
+
+    // Begin streaming into `scene`, which is cleared, `budget` bytes of
+    // instances per update(). Both cancel a running load. Only flat,
+    // single-mesh scenes are streamed; others leave `scene` untouched, and
+    // an open `file` then stays with the caller.
+    FileStart start(SceneFile* file, SceneStore& scene, size_t budget);
+    bool start(const SceneSpec& spec, SceneStore& scene, size_t budget);
+
+    // Stop the worker and drop what is not resident yet; the store keeps
+    // the resident part.
+    void cancel();
+
+    bool loading() const { return resident_objects < total_objects; }
+    size_t total() const { return total_objects; }
+    size_t resident() const { return resident_objects; }
+
+    // Instances of the resident objects in model order, valid until the
+    // next start() or cancel().
+    const InstancedRenderer::Instance* instances() const { return packed; }
+
+    // Append the decoded chunks whose instances fit in this frame's budget
+    // to `scene`. Returns the number of objects that became resident.
+    size_t update(SceneStore& scene);
+
+private:
+    struct Chunk {
+        size_t first = 0;
+        size_t count = 0;
+        std::vector<float> components[SceneStore::COMPONENT_COUNT];
+    };
+
+    void begin(size_t count, size_t budget, SceneStore& scene);
+    void worker_loop();
+    void decode(Chunk& chunk);
+
+    SceneFile* file = nullptr;  // null when generating from `spec`
+    SceneSpec spec;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable space;
+    std::deque<Chunk> ready;
+    bool stopping = false;
+
+    // Written by the worker ahead of resident_objects, read by the render thread behind it
+    InstancedRenderer::Instance* packed = nullptr;
+    size_t chunk_objects = CHUNK_OBJECTS;
+    size_t budget_objects = CHUNK_OBJECTS;
+
+    size_t total_objects = 0;
+    size_t resident_objects = 0;
+};
@@ -0,0 +1,260 @@
+#include "scene_store.h"
+
+#include <bit>
+#include <iostream>
+
+SceneStore::SceneStore(ThreadPool* pool)
+	: pool(pool)
+{
+}
+
+void SceneStore::clear()
+{
+	for (FloatArray& component : components)
+		component.clear();
+	world.clear();
+	dirty.clear();
+	any_dirty = false;
+	parents.clear();
+	first_child.clear();
+	child_end.clear();
+	parents_end = 0;
+}
+
+void SceneStore::reserve(size_t count)
+{
+	for (FloatArray& component : components)
+		component.reserve(count);
+	world.reserve(count);
+	dirty.reserve((count + 63) / 64);
+	parents.reserve(count);
+	first_child.reserve(count);
+	child_end.reserve(count);
+}
+
+void SceneStore::assign_roots(size_t count)
+{
+	clear();
+	append_roots(count);
+}
+
+size_t SceneStore::append_roots(size_t count)
+{
+	if (hierarchical())
+	{
+		std::cerr << "Cannot append root objects behind child nodes." << std::endl;
+		return NO_PARENT;
+	}
+	size_t first = size();
+	size_t end = first + count;
+	components[QW].resize(end, 1.f);
+	components[SCALE].resize(end, 1.f);
+	for (Component c : { X, Y, Z, QX, QY, QZ })
+		components[c].resize(end, 0.f);
+	parents.resize(end, NO_PARENT);
+	first_child.resize(end, 0);
+	child_end.resize(end, 0);
+
+	dirty.resize((end + 63) / 64, 0);
+	if (count == 0)
+		return first;
+	size_t words_begin = first / 64, words_end = (end + 63) / 64;
+	for (size_t w = words_begin; w < words_end; w++)
+	{
+		size_t low = std::max(first, w * 64), high = std::min(end, w * 64 + 64);
+		dirty[w] |= high - low == 64 ? ~uint64_t(0) : ((uint64_t(1) << (high - low)) - 1) << (low % 64);
+	}
+	dirty_words_begin = any_dirty ? std::min(dirty_words_begin, words_begin) : words_begin;
+	dirty_words_end = any_dirty ? std::max(dirty_words_end, words_end) : words_end;
+	any_dirty = true;
+	return first;
+}
+
+size_t SceneStore::add(const glm::vec3& position, const glm::quat& orientation, float scale, size_t parent)
+{
+	size_t i = size();
+	bool root = parent == NO_PARENT;
+	if ((root && parents_end > 0) || (!root && (parent >= i || parent + 1 < parents_end)))
+	{
+		std::cerr << "Scene node " << i << " is not in breadth-first order, skipped." << std::endl;
+		return NO_PARENT;
+	}
+	if (!root)
+	{
+		// Nodes passed over have no children; theirs would have started here
+		for (size_t q = parents_end; q <= parent; q++)
+			first_child[q] = child_end[q] = static_cast<uint32_t>(i);
+		child_end[parent] = static_cast<uint32_t>(i + 1);
+		parents_end = parent + 1;
+	}
+	parents.push_back(parent);
+	first_child.push_back(0);
+	child_end.push_back(0);
+
+	components[X].push_back(position.x);
+	components[Y].push_back(position.y);
+	components[Z].push_back(position.z);
+	components[QX].push_back(orientation.x);
+	components[QY].push_back(orientation.y);
+	components[QZ].push_back(orientation.z);
+	components[QW].push_back(orientation.w);
+	components[SCALE].push_back(scale);
+
+	if (i / 64 >= dirty.size())
+		dirty.push_back(0);
+	mark_dirty(i);
+	return i;
+}
+
+glm::vec3 SceneStore::position(size_t i) const
+{
+	return glm::vec3(components[X][i], components[Y][i], components[Z][i]);
+}
+
+glm::quat SceneStore::orientation(size_t i) const
+{
+	return glm::quat(components[QW][i], components[QX][i], components[QY][i], components[QZ][i]);
+}
+
+void SceneStore::set_position(size_t i, const glm::vec3& position)
+{
+	components[X][i] = position.x;
+	components[Y][i] = position.y;
+	components[Z][i] = position.z;
+	mark_dirty(i);
+}
+
+void SceneStore::set_orientation(size_t i, const glm::quat& orientation)
+{
+	components[QX][i] = orientation.x;
+	components[QY][i] = orientation.y;
+	components[QZ][i] = orientation.z;
+	components[QW][i] = orientation.w;
+	mark_dirty(i);
+}
+
+void SceneStore::set_scale(size_t i, float scale)
+{
+	components[SCALE][i] = scale;
+	mark_dirty(i);
+}
+
+size_t SceneStore::root_of(size_t i) const
+{
+	while (parents[i] != NO_PARENT)
+		i = parents[i];
+	return i;
+}
+
+void SceneStore::clear_dirty(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++)
+		dirty[i / 64] &= ~(uint64_t(1) << (i % 64));
+}
+
+glm::mat4 SceneStore::compose(const glm::vec3& position, const glm::quat& orientation, float scale)
+{
+	glm::mat4 m = glm::mat4_cast(orientation);
+	m[0] *= scale;
+	m[1] *= scale;
+	m[2] *= scale;
+	m[3] = glm::vec4(position, 1.0f);
+	return m;
+}
+
+glm::mat4 SceneStore::local_matrix(size_t i) const
+{
+	return compose(position(i), orientation(i), components[SCALE][i]);
+}
+
+void SceneStore::update_subtree(size_t i)
+{
+	for_each_subtree_range(i, [this](size_t begin, size_t end) {
+		for (size_t n = begin; n < end; n++)
+			world[n] = parents[n] == NO_PARENT ? local_matrix(n) : world[parents[n]] * local_matrix(n);
+		clear_dirty(begin, end);
+	});
+}
+
+void SceneStore::mark_dirty(size_t i)
+{
+	size_t w = i / 64;
+	dirty[w] |= uint64_t(1) << (i % 64);
+	dirty_words_begin = any_dirty ? std::min(dirty_words_begin, w) : w;
+	dirty_words_end = any_dirty ? std::max(dirty_words_end, w + 1) : w + 1;
+	any_dirty = true;
+}
+
+void SceneStore::rotate_all_local(const glm::quat& rotation)
+{
+	size_t count = size();
+	pool->parallel_for(count, WORDS_PER_CHUNK * 64, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			glm::quat q = glm::normalize(orientation(i) * rotation);
+			components[QX][i] = q.x;
+			components[QY][i] = q.y;
+			components[QZ][i] = q.z;
+			components[QW][i] = q.w;
+		}
+		// Chunks are whole words, so no two threads share one
+		for (size_t w = begin / 64; w < (end + 63) / 64; w++)
+			dirty[w] = ~uint64_t(0);
+	});
+	any_dirty = count > 0;
+	dirty_words_begin = 0;
+	dirty_words_end = dirty.size();
+}
+
+const std::vector<glm::mat4>& SceneStore::world_matrices()
+{
+	if (!any_dirty)
+		return world;
+
+	// Objects are added without growing the cache; it catches up here
+	if (world.size() < size())
+		world.resize(size());
+
+	if (hierarchical())
+	{
+		// In index order a dirty ancestor comes first and its sweep clears the
+		// bits of everything below it, so no node is derived twice
+		for (size_t w = dirty_words_begin; w < dirty_words_end; w++)
+		{
+			while (dirty[w])
+			{
+				size_t i = w * 64 + std::countr_zero(dirty[w]);
+				if (i >= world.size())
+				{
+					dirty[w] = 0;
+					break;
+				}
+				update_subtree(i);
+			}
+		}
+		any_dirty = false;
+		return world;
+	}
+
+	pool->parallel_for(dirty_words_end - dirty_words_begin, WORDS_PER_CHUNK, [&](size_t begin, size_t end) {
+		for (size_t w = dirty_words_begin + begin; w < dirty_words_begin + end; w++)
+		{
+			for (uint64_t bits = dirty[w]; bits; bits &= bits - 1)
+			{
+				size_t i = w * 64 + std::countr_zero(bits);
+				if (i >= world.size())
+					break;
+				world[i] = local_matrix(i);
+			}
+			dirty[w] = 0;
+		}
+	});
+	any_dirty = false;
+	return world;
+}
+
+void SceneStore::pack_3x4(const glm::mat4& m, glm::vec4 rows[3])
+{
+	for (int r = 0; r < 3; r++)
+		rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+}
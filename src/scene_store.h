@@ -0,0 +1,149 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Allocator handing out storage aligned for full-width SIMD loads.
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+};
+
+// The objects of the scene as position, orientation (unit quaternion) and
+// uniform scale, one 32-byte aligned array per component. CPU kernels that
+// need the placement read 32 bytes per object from here instead of a 64-byte
+// matrix. World matrices are derived lazily: a change only sets the object's
+// dirty bit and world_matrices() rebuilds the dirty ones on the thread pool.
+// For upload they are packed into the three top rows (pack_3x4).
+//
+// Objects may have a parent, whose world matrix then precedes their own
+// placement (assemblies). Nodes are stored breadth first: all roots, then
+// the children of node 0, of node 1, ... so the children of a node are one
+// index range, and so are the descendants of a node on each level below it.
+// A dirty node re-derives its subtree level by level, one linear sweep over
+// exactly the affected nodes.
+class SceneStore {
+public:
+    static constexpr size_t NO_PARENT = SIZE_MAX;
+
+    enum Component {
+        X, Y, Z,
+        QX, QY, QZ, QW,
+        SCALE,
+        COMPONENT_COUNT
+    };
+
+    using FloatArray = std::vector<float, AlignedAllocator<float, 32>>;
+
+    explicit SceneStore(ThreadPool* pool);
+
+    size_t size() const { return components[X].size(); }
+    void clear();
+    void reserve(size_t count);
+
+    // Replace the scene by `count` root objects for a generator to fill in
+    // place through the mutable data(); all of them start dirty.
+    void assign_roots(size_t count);
+
+    // Add `count` dirty root objects at the origin behind the existing ones
+    // and return the index of the first, for filling in place like above.
+    // Only while there are no child nodes; NO_PARENT otherwise.
+    size_t append_roots(size_t count);
+
+    // Returns the index of the new object. The placement is relative to
+    // `parent`. Nodes must come in breadth-first order: roots first, then
+    // children with non-decreasing parents; otherwise nothing is added and
+    // NO_PARENT is returned.
+    size_t add(const glm::vec3& position, const glm::quat& orientation, float scale = 1.f, size_t parent = NO_PARENT);
+
+    bool hierarchical() const { return parents_end > 0; }
+    size_t parent(size_t i) const { return parents[i]; }
+    size_t root_of(size_t i) const;
+
+    // Call fn(begin, end) for the index ranges of node i and its descendants, level by level.
+    template <typename Fn>
+    void for_each_subtree_range(size_t i, Fn fn) const;
+
+    glm::vec3 position(size_t i) const;
+    glm::quat orientation(size_t i) const;
+    float scale(size_t i) const { return components[SCALE][i]; }
+
+    void set_position(size_t i, const glm::vec3& position);
+    void set_orientation(size_t i, const glm::quat& orientation);
+    void set_scale(size_t i, float scale);
+
+    // Turn every object by `rotation` about its own origin, in object space.
+    void rotate_all_local(const glm::quat& rotation);
+
+    // One component of all objects, e.g. for SIMD kernels. Writing through
+    // the mutable one bypasses the dirty bits; only for assign_roots() fills.
+    const float* data(Component c) const { return components[c].data(); }
+    float* data(Component c) { return components[c].data(); }
+
+    // World matrices of all objects, rebuilding the dirty ones first.
+    const std::vector<glm::mat4>& world_matrices();
+
+    // Local matrix of a placement: translate * rotate * scale.
+    static glm::mat4 compose(const glm::vec3& position, const glm::quat& orientation, float scale);
+
+    // The rows of an affine matrix without its constant (0 0 0 1) bottom row.
+    static void pack_3x4(const glm::mat4& m, glm::vec4 rows[3]);
+
+private:
+    static constexpr size_t WORDS_PER_CHUNK = 256;
+
+    void mark_dirty(size_t i);
+    void clear_dirty(size_t begin, size_t end);
+    glm::mat4 local_matrix(size_t i) const;
+    // Re-derive node i and its descendants from their parents.
+    void update_subtree(size_t i);
+
+    ThreadPool* pool;
+    FloatArray components[COMPONENT_COUNT];
+    std::vector<glm::mat4> world;
+    std::vector<uint64_t> dirty;     // one bit per object
+    bool any_dirty = false;
+    size_t dirty_words_begin = 0, dirty_words_end = 0;  // words that may hold set bits
+
+    std::vector<size_t> parents;
+    // Children of node i are [first_child[i], child_end[i]); only set for
+    // nodes below parents_end, later nodes have no children yet
+    std::vector<uint32_t> first_child, child_end;
+    size_t parents_end = 0;
+};
+
+template <typename Fn>
+void SceneStore::for_each_subtree_range(size_t i, Fn fn) const
+{
+    size_t begin = i, end = i + 1;
+    while (begin < end)
+    {
+        fn(begin, end);
+        if (begin >= parents_end)
+            break;
+        // Children of consecutive nodes are consecutive
+        size_t last = std::min(end, parents_end) - 1;
+        begin = first_child[begin];
+        end = child_end[last];
+    }
+}
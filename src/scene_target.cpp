@@ -0,0 +1,81 @@
+#include "scene_target.h"
+#include "pick_readback.h"
+
+#include <iostream>
+
+SceneTarget::SceneTarget()
+{
+	glGenFramebuffers(1, &fbo);
+	glGenRenderbuffers(1, &color_buffer);
+	glGenRenderbuffers(1, &id_buffer);
+	glGenRenderbuffers(1, &depth_buffer);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, id_buffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+
+	// Fragment output 0 is the colour, output 1 the ID
+	const GLenum draw_buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, draw_buffers);
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Storage is allocated at the size of the first frame
+}
+
+SceneTarget::~SceneTarget()
+{
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &color_buffer);
+	glDeleteRenderbuffers(1, &id_buffer);
+	glDeleteRenderbuffers(1, &depth_buffer);
+}
+
+void SceneTarget::resize(int new_width, int new_height)
+{
+	if (new_width == width && new_height == height)
+		return;
+	width = new_width;
+	height = new_height;
+
+	glBindRenderbuffer(GL_RENDERBUFFER, color_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, id_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Scene target framebuffer not complete!" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void SceneTarget::bind()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+void SceneTarget::clear(const glm::vec4& color)
+{
+	// Each attachment is cleared with the call matching its type
+	glClearBufferfv(GL_COLOR, 0, &color[0]);
+	const GLuint background[4] = { PICK_BACKGROUND_ID, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 1, background);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void SceneTarget::blit_to_window()
+{
+	// The read buffer is per framebuffer; switch to the colour for the copy only
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Offscreen target of the single-pass mode. The visual pass writes its colour
+// to attachment 0 and the object ID to the R32UI attachment 1 in the same
+// draw, so the ID image of the displayed frame is always at hand and a pick
+// is only a readback, never another scene traversal. The colour is blitted to
+// the window at the end of the frame.
+class SceneTarget {
+public:
+    SceneTarget();
+    ~SceneTarget();
+
+    SceneTarget(const SceneTarget&) = delete;
+    SceneTarget& operator=(const SceneTarget&) = delete;
+
+    // Match the window; the storage is only reallocated when the size changes.
+    void resize(int width, int height);
+
+    // Bind for drawing into both attachments. The ID attachment is the read
+    // buffer, so PickReadback reads IDs while this target is bound.
+    void bind();
+
+    // Clear colour to `color`, IDs to PICK_BACKGROUND_ID and depth.
+    void clear(const glm::vec4& color);
+
+    // Copy the colour into the window and leave the window framebuffer bound,
+    // with its depth cleared for the overlay.
+    void blit_to_window();
+
+private:
+    GLuint fbo = 0;
+    GLuint color_buffer = 0, id_buffer = 0, depth_buffer = 0;
+    int width = 0, height = 0;
+};
@@ -0,0 +1,128 @@
+#include "selection_flags.h"
+
+#include <algorithm>
+
+SelectionFlags::SelectionFlags()
+{
+	glGenBuffers(1, &buffer);
+	glGenTextures(1, &texture);
+
+	// A buffer texture needs storage before it can be sampled
+	words.assign(1, 0);
+	upload();
+}
+
+SelectionFlags::~SelectionFlags()
+{
+	glDeleteTextures(1, &texture);
+	glDeleteBuffers(1, &buffer);
+}
+
+void SelectionFlags::mark_dirty(size_t first_word, size_t end_word)
+{
+	if (dirty_begin == dirty_end)
+	{
+		dirty_begin = first_word;
+		dirty_end = end_word;
+		return;
+	}
+	dirty_begin = std::min(dirty_begin, first_word);
+	dirty_end = std::max(dirty_end, end_word);
+}
+
+void SelectionFlags::resize(size_t new_count)
+{
+	if (new_count == count)
+		return;
+
+	// Drop the bits of models that no longer exist, including those in the
+	// tail of the last word
+	for (size_t i = new_count; i < count; i++)
+	{
+		if (test(i))
+			set(i, false);
+	}
+	count = new_count;
+	size_t word_count = std::max<size_t>(1, (count + 31) / 32);
+	if (word_count != words.size())
+	{
+		size_t old_size = words.size();
+		words.resize(word_count, 0);
+		if (word_count > old_size)
+			mark_dirty(old_size, word_count);
+		dirty_end = std::min(dirty_end, word_count);
+		dirty_begin = std::min(dirty_begin, dirty_end);
+	}
+}
+
+void SelectionFlags::set(size_t index, bool on)
+{
+	if (index >= count)
+		return;
+	uint32_t& word = words[index >> 5];
+	uint32_t bit = 1u << (index & 31);
+	if (((word & bit) != 0) == on)
+		return;
+
+	word ^= bit;
+	if (on)
+		++selected;
+	else
+		--selected;
+	mark_dirty(index >> 5, (index >> 5) + 1);
+}
+
+void SelectionFlags::clear()
+{
+	if (selected == 0)
+		return;
+
+	// Only the words that hold a set bit need rewriting
+	size_t first = 0, last = 0;
+	bool found = false;
+	for (size_t w = 0; w < words.size(); w++)
+	{
+		if (words[w] == 0)
+			continue;
+		if (!found)
+			first = w;
+		last = w;
+		found = true;
+		words[w] = 0;
+	}
+	mark_dirty(first, last + 1);
+	selected = 0;
+}
+
+void SelectionFlags::upload()
+{
+	if (words.size() > capacity)
+	{
+		// Grow with headroom; the texture has to be re-attached to the new storage
+		capacity = words.size() + words.size() / 2;
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, capacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, words.size() * sizeof(uint32_t), words.data());
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, buffer);
+		dirty_begin = dirty_end = 0;
+		return;
+	}
+	if (dirty_begin == dirty_end)
+		return;
+
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, dirty_begin * sizeof(uint32_t), (dirty_end - dirty_begin) * sizeof(uint32_t),
+		words.data() + dirty_begin);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	dirty_begin = dirty_end = 0;
+}
+
+void SelectionFlags::bind() const
+{
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+}
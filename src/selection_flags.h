@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Selection state of every model as one bit per model, mirrored into a
+// GL_R32UI buffer texture that the visual shaders read with texelFetch.
+// Changing bits only widens a dirty word range; upload() sends that range
+// with one glBufferSubData, so (de)selecting any number of objects costs one
+// partial buffer update per frame and no extra draw calls.
+class SelectionFlags {
+public:
+    // Texture unit the visual shaders sample the flags from.
+    static constexpr GLuint TEXTURE_UNIT = 0;
+
+    SelectionFlags();
+    ~SelectionFlags();
+
+    SelectionFlags(const SelectionFlags&) = delete;
+    SelectionFlags& operator=(const SelectionFlags&) = delete;
+
+    // Track `count` models; flags of models beyond it are dropped.
+    void resize(size_t count);
+    size_t size() const { return count; }
+
+    void set(size_t index, bool on);
+    bool test(size_t index) const { return index < count && (words[index >> 5] >> (index & 31)) & 1u; }
+    void clear();
+    size_t selected_count() const { return selected; }
+
+    // Send the changed words, if any, to the buffer.
+    void upload();
+
+    // Bind the buffer texture to TEXTURE_UNIT.
+    void bind() const;
+
+private:
+    void mark_dirty(size_t first_word, size_t end_word);
+
+    GLuint buffer = 0, texture = 0;
+    std::vector<uint32_t> words;
+    size_t count = 0;
+    size_t selected = 0;
+    size_t capacity = 0;        // words allocated in the buffer
+    size_t dirty_begin = 0, dirty_end = 0;
+};
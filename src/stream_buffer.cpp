@@ -0,0 +1,128 @@
+#include "stream_buffer.h"
+
+#include <iostream>
+
+namespace {
+	// Segment offsets stay aligned for any attribute or uniform block use
+	constexpr size_t SEGMENT_ALIGNMENT = 256;
+
+	constexpr GLbitfield PERSISTENT_FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+}
+
+StreamBuffer::StreamBuffer(GLenum target)
+	: target(target), persistent(GLAD_GL_ARB_buffer_storage != 0)
+{
+}
+
+StreamBuffer::~StreamBuffer()
+{
+	release();
+}
+
+void StreamBuffer::release()
+{
+	for (GLsync& fence : fences)
+	{
+		if (fence)
+			glDeleteSync(fence);
+		fence = nullptr;
+	}
+	if (mapped)
+	{
+		glBindBuffer(target, name);
+		glUnmapBuffer(target);
+		glBindBuffer(target, 0);
+		mapped = nullptr;
+	}
+	// Deletion is deferred by GL until pending draws no longer use the storage
+	glDeleteBuffers(1, &name);
+	name = 0;
+}
+
+void StreamBuffer::allocate(size_t size)
+{
+	// Headroom, so that a slowly growing scene does not reallocate every frame
+	size += size / 2;
+	segment_size = (size + SEGMENT_ALIGNMENT - 1) / SEGMENT_ALIGNMENT * SEGMENT_ALIGNMENT;
+	++stats.reallocations;
+	create_storage();
+}
+
+void StreamBuffer::create_storage()
+{
+	release();
+	segment = SEGMENT_COUNT - 1;
+
+	glGenBuffers(1, &name);
+	glBindBuffer(target, name);
+	GLsizeiptr total = static_cast<GLsizeiptr>(segment_size * SEGMENT_COUNT);
+	if (persistent)
+	{
+		glBufferStorage(target, total, NULL, PERSISTENT_FLAGS);
+		mapped = static_cast<char*>(glMapBufferRange(target, 0, total, PERSISTENT_FLAGS));
+		if (mapped)
+			return;
+
+		std::cerr << "Persistent mapping failed, streaming through orphaned buffers instead." << std::endl;
+		persistent = false;
+		// Immutable storage cannot be respecified, start over with a mutable buffer
+		glDeleteBuffers(1, &name);
+		glGenBuffers(1, &name);
+		glBindBuffer(target, name);
+	}
+	glBufferData(target, total, NULL, GL_STREAM_DRAW);
+}
+
+void* StreamBuffer::map(size_t size, size_t& offset)
+{
+	if (size > segment_size || name == 0)
+		allocate(size);
+	else if (persistent && stats.frames > 0)
+	{
+		// Fence the segment written last frame behind everything that read it
+		if (fences[segment])
+			glDeleteSync(fences[segment]);
+		fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	segment = (segment + 1) % SEGMENT_COUNT;
+	offset = segment * segment_size;
+	stats.last_frame_bytes = size;
+	stats.total_bytes += size;
+	++stats.frames;
+
+	if (persistent && fences[segment])
+	{
+		// With three segments the GPU is normally two frames past this one
+		GLenum status = glClientWaitSync(fences[segment], 0, 0);
+		glDeleteSync(fences[segment]);
+		fences[segment] = nullptr;
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			// Never wait for the GPU: start over in fresh storage, like orphaning.
+			// GL frees the old buffer once the draws that read it are done.
+			++stats.stalls;
+			create_storage();
+			segment = 0;
+			offset = 0;
+		}
+	}
+
+	glBindBuffer(target, name);
+	if (persistent)
+		return mapped + offset;
+
+	// Wrapping around: orphan the storage instead of waiting for the GPU to
+	// finish with the segments queued so far
+	if (segment == 0)
+		glBufferData(target, static_cast<GLsizeiptr>(segment_size * SEGMENT_COUNT), NULL, GL_STREAM_DRAW);
+	return glMapBufferRange(target, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size),
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+void StreamBuffer::unmap()
+{
+	// Coherent persistent mappings need neither an unmap nor a flush
+	if (!persistent)
+		glUnmapBuffer(target);
+}
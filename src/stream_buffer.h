@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+
+// Ring of per-frame segments for data rewritten every frame (e.g. animated
+// instance matrices). With ARB_buffer_storage the buffer is mapped once,
+// persistent and coherent, and a fence behind each segment tells when the GPU
+// is done reading it; if it is not, the ring moves to fresh storage rather
+// than waiting. On plain 3.3 each segment is mapped UNSYNCHRONIZED and
+// the storage is orphaned with glBufferData(NULL) when the ring wraps, so the
+// driver hands out fresh memory instead of making the CPU wait.
+class StreamBuffer {
+public:
+    static constexpr int SEGMENT_COUNT = 3;
+
+    struct Stats {
+        size_t last_frame_bytes = 0;
+        uint64_t total_bytes = 0;
+        uint64_t frames = 0;
+        uint64_t stalls = 0;        // a segment was still in use by the GPU; fresh storage was taken instead
+        uint64_t reallocations = 0;
+    };
+
+    explicit StreamBuffer(GLenum target = GL_ARRAY_BUFFER);
+    ~StreamBuffer();
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    // Start the next frame's segment and return `size` writable bytes.
+    // `offset` receives where they start in buffer(). Everything submitted
+    // before this call is fenced as the user of the previous segment.
+    void* map(size_t size, size_t& offset);
+
+    // Make the written bytes visible to the GPU; the buffer stays bound.
+    void unmap();
+
+    GLuint buffer() const { return name; }
+    bool is_persistent() const { return persistent; }
+    const Stats& get_stats() const { return stats; }
+
+private:
+    void allocate(size_t size);
+    // New storage for the current segment size; the old buffer is released.
+    void create_storage();
+    void release();
+
+    GLenum target;
+    GLuint name = 0;
+    bool persistent;
+    char* mapped = nullptr;
+    size_t segment_size = 0;
+    int segment = SEGMENT_COUNT - 1;
+    GLsync fences[SEGMENT_COUNT] = {};
+    Stats stats;
+};
@@ -0,0 +1,84 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <latch>
+
+ThreadPool::ThreadPool(unsigned thread_count)
+{
+	if (thread_count == 0)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned i = 1; i < thread_count; i++)
+	{
+		workers.emplace_back([this] { worker_loop(); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::worker_loop()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty())
+				return;
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
+
+void ThreadPool::parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+	size_t chunks = chunk_count(count, grain);
+	if (chunks == 0)
+		return;
+	if (chunks == 1 || workers.empty())
+	{
+		for (size_t begin = 0; begin < count; begin += grain)
+			body(begin, std::min(count, begin + grain));
+		return;
+	}
+
+	std::atomic<size_t> next{ 0 };
+	auto run_chunks = [&] {
+		for (size_t chunk = next++; chunk < chunks; chunk = next++)
+		{
+			size_t begin = chunk * grain;
+			body(begin, std::min(count, begin + grain));
+		}
+	};
+
+	// Helpers reference this stack frame, so wait for every one of them to
+	// leave run_chunks, not just for the chunks to be done
+	size_t helpers = std::min(workers.size(), chunks - 1);
+	std::latch done(static_cast<std::ptrdiff_t>(helpers));
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < helpers; i++)
+		{
+			tasks.push([&] { run_chunks(); done.count_down(); });
+		}
+	}
+	wake.notify_all();
+
+	run_chunks();
+	done.wait();
+}
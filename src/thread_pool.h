@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for the CPU side kernels (selection, culling,
+// sorting). parallel_for() splits an index range into chunks that the
+// workers and the calling thread take in turn, and returns once all are done.
+class ThreadPool {
+public:
+    // 0 picks one worker less than the hardware threads; the caller is the last one.
+    explicit ThreadPool(unsigned thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // body(begin, end) is called for consecutive chunks of at most `grain` indices.
+    void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+    // Chunk count a parallel_for over `count` indices will use; lets callers
+    // size per-chunk output buffers up front.
+    static size_t chunk_count(size_t count, size_t grain) { return grain ? (count + grain - 1) / grain : 0; }
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+private:
+    void worker_loop();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
@@ -0,0 +1,533 @@
+// Checks of the scene code that need no GL context. Returns the number of
+// failed checks; timings are printed for reference only.
+
+#include "scene_store.h"
+#include "scene_file.h"
+#include "scene_generator.h"
+#include "scene_loader.h"
+#include "cube_vbo.h"
+#include "frustum_selector.h"
+#include "bvh_picker.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <thread>
+
+namespace {
+	int failures = 0;
+
+	void check(bool condition, const char* what)
+	{
+		if (!condition)
+		{
+			std::printf("FAILED: %s\n", what);
+			++failures;
+		}
+	}
+
+	bool near(const glm::mat4& a, const glm::mat4& b)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			if (glm::length(a[c] - b[c]) > 1e-4f)
+				return false;
+		}
+		return true;
+	}
+
+	bool same_components(const SceneStore& a, const SceneStore& b)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+		{
+			auto component = static_cast<SceneStore::Component>(c);
+			if (std::memcmp(a.data(component), b.data(component), a.size() * sizeof(float)) != 0)
+				return false;
+		}
+		return true;
+	}
+
+	std::string temp_path(const char* name)
+	{
+		return (std::filesystem::temp_directory_path() / name).string();
+	}
+
+	void test_subtree_updates(ThreadPool* pool)
+	{
+		// Two roots, two children of root 0, one grandchild below child 2
+		SceneStore scene(pool);
+		glm::quat turn = glm::angleAxis(glm::radians(90.f), glm::vec3(0.f, 1.f, 0.f));
+		scene.add(glm::vec3(0.f), glm::quat(1.f, 0.f, 0.f, 0.f));
+		scene.add(glm::vec3(5.f, 0.f, 0.f), glm::quat(1.f, 0.f, 0.f, 0.f));
+		scene.add(glm::vec3(1.f, 0.f, 0.f), turn, 2.f, 0);
+		scene.add(glm::vec3(0.f, 1.f, 0.f), glm::quat(1.f, 0.f, 0.f, 0.f), 1.f, 0);
+		scene.add(glm::vec3(0.f, 0.f, 1.f), glm::quat(1.f, 0.f, 0.f, 0.f), 1.f, 2);
+		check(scene.hierarchical() && scene.root_of(4) == 0, "hierarchy is recorded");
+		check(scene.add(glm::vec3(0.f), glm::quat(1.f, 0.f, 0.f, 0.f), 1.f, 1) == SceneStore::NO_PARENT,
+			"a node out of breadth-first order is refused");
+
+		std::vector<glm::mat4> before = scene.world_matrices();
+		auto local = [&](size_t i) { return SceneStore::compose(scene.position(i), scene.orientation(i), scene.scale(i)); };
+		check(near(before[4], local(0) * local(2) * local(4)), "world matrix is the product along the path");
+
+		// Moving the root moves its whole subtree and nothing else
+		scene.set_position(0, glm::vec3(0.f, 3.f, 0.f));
+		const std::vector<glm::mat4>& after = scene.world_matrices();
+		check(near(after[2], local(0) * local(2)), "child follows its moved parent");
+		check(near(after[4], local(0) * local(2) * local(4)), "grandchild follows its moved root");
+		check(near(after[1], before[1]), "other root is unchanged");
+
+		// Changing a child only touches its own descendants
+		scene.set_scale(2, 1.f);
+		const std::vector<glm::mat4>& scaled = scene.world_matrices();
+		check(near(scaled[4], local(0) * local(2) * local(4)), "grandchild follows its rescaled parent");
+		check(near(scaled[3], local(0) * local(3)), "sibling is unchanged");
+
+		size_t visited = 0;
+		scene.for_each_subtree_range(0, [&](size_t begin, size_t end) { visited += end - begin; });
+		check(visited == 4, "subtree of root 0 covers it and its three descendants");
+	}
+
+	void test_large_subtree_update(ThreadPool* pool)
+	{
+		// Roots with 8 children of 16 children each, so moving a root re-derives
+		// 136 descendants out of about a million nodes
+		const size_t roots = 7300, children = 8, grandchildren = 16;
+		auto build = [&](SceneStore& scene, const glm::vec3& moved_root) {
+			glm::quat identity(1.f, 0.f, 0.f, 0.f);
+			glm::quat turn = glm::angleAxis(0.3f, glm::normalize(glm::vec3(1.f, 2.f, 3.f)));
+			for (size_t r = 0; r < roots; r++)
+				scene.add(r == roots / 2 ? moved_root : glm::vec3(float(r), 0.f, 0.f), identity);
+			for (size_t r = 0; r < roots; r++)
+				for (size_t c = 0; c < children; c++)
+					scene.add(glm::vec3(0.f, float(c), 0.f), turn, 0.5f, r);
+			for (size_t p = roots; p < roots + roots * children; p++)
+				for (size_t g = 0; g < grandchildren; g++)
+					scene.add(glm::vec3(0.f, 0.f, float(g)), turn, 0.5f, p);
+		};
+		glm::vec3 original(float(roots / 2), 0.f, 0.f), moved(1.f, 2.f, 3.f);
+		SceneStore scene(pool);
+		build(scene, original);
+		std::vector<glm::mat4> before = scene.world_matrices();
+
+		auto start = std::chrono::steady_clock::now();
+		scene.set_position(roots / 2, moved);
+		const std::vector<glm::mat4>& after = scene.world_matrices();
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+		SceneStore reference(pool);
+		build(reference, moved);
+		const std::vector<glm::mat4>& full = reference.world_matrices();
+		std::vector<bool> in_subtree(scene.size(), false);
+		size_t descendants = 0;
+		scene.for_each_subtree_range(roots / 2, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				in_subtree[i] = true;
+			descendants += end - begin;
+		});
+		bool same = after.size() == full.size();
+		bool others_kept = true;
+		for (size_t i = 0; same && i < after.size(); i++)
+		{
+			same = std::memcmp(&after[i], &full[i], sizeof(glm::mat4)) == 0;
+			others_kept = others_kept && (in_subtree[i] || std::memcmp(&after[i], &before[i], sizeof(glm::mat4)) == 0);
+		}
+		check(descendants == 1 + children + children * grandchildren, "subtree holds the root and its 136 descendants");
+		check(same, "subtree update equals a full recomputation bit for bit");
+		check(others_kept, "nodes outside the subtree keep their matrices");
+		std::printf("subtree update: %zu descendants of %zu nodes in %.1f us\n", descendants - 1, scene.size(), elapsed.count());
+	}
+
+	void test_generator_determinism()
+	{
+		// One worker against eight, over several chunks of the pool
+		ThreadPool one(1), eight(8);
+		bool same = true;
+		for (int shape = 0; shape < static_cast<int>(SceneShape::SHAPE_COUNT); shape++)
+		{
+			SceneSpec spec;
+			spec.shape = static_cast<SceneShape>(shape);
+			spec.count = 300007;
+			spec.seed = 5;
+			SceneStore serial(&one), parallel(&eight);
+			generate_scene(spec, serial, &one);
+			generate_scene(spec, parallel, &eight);
+			same = same && serial.size() == spec.count && same_components(serial, parallel);
+		}
+		SceneSpec demo;
+		demo.assemblies = true;
+		SceneStore serial(&one), parallel(&eight);
+		generate_scene(demo, serial, &one);
+		generate_scene(demo, parallel, &eight);
+		check(same, "every shape is bit-identical with 1 and 8 threads");
+		check(same_components(serial, parallel), "assemblies are bit-identical with 1 and 8 threads");
+
+		// A piece generated on its own equals the same range of the whole scene
+		SceneSpec spec;
+		spec.shape = SceneShape::LongStructures;
+		spec.count = 300007;
+		SceneStore whole(&one);
+		generate_scene(spec, whole, &one);
+		const size_t begin = 100003, end = 200009;
+		std::vector<float> piece[SceneStore::COMPONENT_COUNT];
+		float* components[SceneStore::COMPONENT_COUNT];
+		for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+		{
+			piece[c].resize(end - begin);
+			components[c] = piece[c].data();
+		}
+		generate_objects(spec, components, begin, end);
+		bool piece_matches = true;
+		for (int c = 0; c < SceneStore::COMPONENT_COUNT; c++)
+			piece_matches = piece_matches && std::memcmp(piece[c].data(), whole.data(static_cast<SceneStore::Component>(c)) + begin, (end - begin) * sizeof(float)) == 0;
+		check(piece_matches, "a piece equals the matching range of the whole scene");
+	}
+
+	void test_file_round_trip(ThreadPool* pool)
+	{
+		std::string path = temp_path("scene_tests_round_trip.bin");
+		SceneSpec spec;
+		spec.shape = SceneShape::RandomCloud;
+		spec.count = 10000;
+		SceneStore flat(pool);
+		generate_scene(spec, flat, pool);
+		std::vector<uint8_t> mesh_ids(flat.size());
+		for (size_t i = 0; i < mesh_ids.size(); i++)
+			mesh_ids[i] = static_cast<uint8_t>(i % MESH_TYPE_COUNT);
+
+		check(SceneFile::write(path, flat, mesh_ids), "flat scene is written");
+		SceneFile file;
+		SceneStore loaded(pool);
+		std::vector<uint8_t> loaded_ids;
+		check(file.open(path) && file.load(loaded, loaded_ids, pool), "flat scene is read back");
+		check(same_components(flat, loaded), "components survive the round trip");
+		check(loaded_ids == mesh_ids, "mesh IDs survive the round trip");
+
+		auto instances = static_cast<const InstancedRenderer::Instance*>(file.section(SceneFile::INSTANCES, sizeof(InstancedRenderer::Instance)));
+		const std::vector<glm::mat4>& world = flat.world_matrices();
+		bool rows_match = instances != nullptr;
+		for (size_t i = 0; rows_match && i < world.size(); i++)
+		{
+			glm::vec4 rows[3];
+			SceneStore::pack_3x4(world[i], rows);
+			rows_match = std::memcmp(rows, instances[i].model_rows, sizeof(rows)) == 0;
+		}
+		check(rows_match, "packed instances match the world matrices");
+		file.close();
+
+		// Assemblies keep their parents
+		SceneSpec demo;
+		demo.assemblies = true;
+		SceneStore assemblies(pool);
+		generate_scene(demo, assemblies, pool);
+		check(SceneFile::write(path, assemblies, {}), "hierarchy is written");
+		SceneStore loaded_assemblies(pool);
+		check(file.open(path) && file.load(loaded_assemblies, loaded_ids, pool), "hierarchy is read back");
+		bool parents_match = loaded_assemblies.size() == assemblies.size() && loaded_assemblies.hierarchical();
+		for (size_t i = 0; parents_match && i < assemblies.size(); i++)
+			parents_match = loaded_assemblies.parent(i) == assemblies.parent(i);
+		check(parents_match && same_components(assemblies, loaded_assemblies), "hierarchy survives the round trip");
+		file.close();
+
+		// An unknown mesh ID rejects the file and leaves the store alone
+		check(SceneFile::write(path, flat, mesh_ids), "flat scene is written again");
+		{
+			// Patch the first mesh ID on disk, found through the section table
+			std::fstream patched(path, std::ios::binary | std::ios::in | std::ios::out);
+			SceneFile::Header header;
+			patched.read(reinterpret_cast<char*>(&header), sizeof(header));
+			uint64_t ids_offset = 0;
+			for (uint32_t s = 0; s < header.section_count; s++)
+			{
+				SceneFile::Section section;
+				patched.read(reinterpret_cast<char*>(&section), sizeof(section));
+				if (section.type == SceneFile::MESH_IDS)
+					ids_offset = section.offset;
+			}
+			check(ids_offset != 0, "mixed scene has a mesh ID section");
+			patched.seekp(static_cast<std::streamoff>(ids_offset));
+			patched.put(static_cast<char>(MESH_TYPE_COUNT));
+		}
+		SceneStore untouched(pool);
+		generate_scene(spec, untouched, pool);
+		check(file.open(path) && !file.load(untouched, loaded_ids, pool), "unknown mesh ID is rejected");
+		check(same_components(untouched, flat), "rejected file leaves the store as it was");
+		file.close();
+
+		std::filesystem::remove(path);
+	}
+
+	void test_loader_chunks(ThreadPool* pool)
+	{
+		SceneSpec spec;
+		spec.shape = SceneShape::LongStructures;
+		spec.count = 300007;
+		spec.seed = 9;
+		SceneStore reference(pool);
+		generate_scene(spec, reference, pool);
+		const std::vector<glm::mat4>& world = reference.world_matrices();
+
+		// A budget below a full chunk makes the chunks smaller
+		const size_t budget = size_t(1) << 20;
+		const size_t budget_objects = budget / sizeof(InstancedRenderer::Instance);
+		SceneLoader loader;
+		SceneStore streamed(pool);
+		check(loader.start(spec, streamed, budget), "generated scene is streamed");
+		check(streamed.size() == 0 && loader.total() == spec.count, "streaming starts from an empty store");
+
+		bool within_budget = true, whole_chunks = true;
+		while (loader.loading())
+		{
+			size_t added = loader.update(streamed);
+			within_budget = within_budget && added <= budget_objects;
+			whole_chunks = whole_chunks && (!loader.loading() || streamed.size() % std::min(SceneLoader::CHUNK_OBJECTS, budget_objects) == 0);
+			// Leave the worker some time, also on a single core
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		check(within_budget, "no update hands over more instances than the budget");
+		check(whole_chunks, "only whole chunks become resident");
+		check(same_components(reference, streamed), "streamed objects equal the generated ones");
+
+		const InstancedRenderer::Instance* instances = loader.instances();
+		bool rows_match = true;
+		for (size_t i = 0; rows_match && i < world.size(); i += 97)
+		{
+			glm::vec4 rows[3];
+			SceneStore::pack_3x4(world[i], rows);
+			for (int r = 0; r < 3; r++)
+				rows_match = rows_match && glm::length(rows[r] - instances[i].model_rows[r]) < 1e-5f;
+		}
+		check(rows_match, "streamed instances match the world matrices");
+
+		// From a file, through the same mapping the caller opened
+		std::string path = temp_path("scene_tests_stream.bin");
+		check(SceneFile::write(path, reference, {}), "scene is written for streaming");
+		SceneFile* file = new SceneFile;
+		SceneStore from_file(pool);
+		check(file->open(path) && loader.start(file, from_file, budget) == SceneLoader::FileStart::Streaming, "flat file is streamed");
+		while (loader.loading())
+		{
+			loader.update(from_file);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		check(same_components(reference, from_file), "streamed file equals the written scene");
+
+		// Hierarchies are left to SceneFile::load(), with the store untouched
+		SceneSpec demo;
+		demo.assemblies = true;
+		SceneStore assemblies(pool);
+		generate_scene(demo, assemblies, pool);
+		check(!loader.start(demo, from_file, budget), "assemblies are not streamed");
+		check(SceneFile::write(path, assemblies, {}), "hierarchy is written for streaming");
+		// The loader would take over a file it streams, so it is allocated like one
+		SceneFile* hierarchy = new SceneFile;
+		SceneLoader::FileStart refused = hierarchy->open(path) ? loader.start(hierarchy, from_file, budget) : SceneLoader::FileStart::Invalid;
+		check(refused == SceneLoader::FileStart::AtOnce, "hierarchy file is refused as one to load at once");
+		check(same_components(reference, from_file), "refused file leaves the store as it was");
+		if (refused != SceneLoader::FileStart::Streaming)
+			delete hierarchy;
+
+		// Cancelling keeps the resident part
+		SceneStore cancelled(pool);
+		loader.start(spec, cancelled, budget);
+		while (cancelled.size() == 0)
+		{
+			loader.update(cancelled);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		loader.cancel();
+		check(!loader.loading() && cancelled.size() > 0 && cancelled.size() < spec.count, "cancel keeps the resident chunks");
+
+		std::filesystem::remove(path);
+	}
+
+	void test_rectangle_paths(ThreadPool* pool)
+	{
+		// Random boxes all around the eye, also behind it and beyond the far
+		// plane; a count that is no multiple of four runs the scalar tail too
+		std::mt19937 random(7);
+		std::uniform_real_distribution<float> position(-80.f, 80.f), component(-1.f, 1.f), size(0.2f, 4.f);
+		std::vector<glm::mat4> models(20003);
+		for (glm::mat4& model : models)
+		{
+			glm::quat rotation = glm::normalize(glm::quat(component(random), component(random), component(random), component(random)));
+			glm::vec3 center(position(random), position(random), position(random));
+			model = glm::scale(glm::translate(glm::mat4(1.f), center) * glm::mat4_cast(rotation), glm::vec3(size(random)));
+		}
+		const float half = 0.5f;
+		glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+		glm::mat4 projection = glm::perspective(glm::radians(60.f), 4.f / 3.f, 0.5f, 50.f);
+		glm::ivec4 viewport(0, 0, 800, 600);
+
+		FrustumSelector selector(pool);
+		selector.build(models, half);
+		const glm::ivec4 rects[] = { viewport, {100, 50, 300, 200}, {390, 290, 20, 20}, {700, 10, 150, 100}, {400, 300, 1, 1} };
+		bool same = true;
+		size_t hits = 0;
+		for (RectangleSemantics semantics : { RectangleSemantics::Window, RectangleSemantics::Crossing })
+		{
+			for (const glm::ivec4& rect : rects)
+			{
+				std::vector<int> simd_ids, scalar_ids;
+				selector.set_simd(true);
+				selector.select(rect, view, projection, viewport, semantics, simd_ids);
+				selector.set_simd(false);
+				selector.select(rect, view, projection, viewport, semantics, scalar_ids);
+				same = same && simd_ids == scalar_ids;
+				hits += simd_ids.size();
+			}
+		}
+		selector.set_simd(true);
+		check(hits > 0, "rectangles select some of the random boxes");
+		check(same, "SIMD and scalar rectangle tests select the same boxes");
+
+		// The frustum kernel against its scalar test
+		Frustum frustum = Frustum::from_matrix(projection * view);
+		std::vector<int> ids;
+		selector.select(frustum, ids);
+		OrientedBoxes boxes;
+		boxes.assign(models, half);
+		std::vector<int> expected;
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			if (box_in_frustum(boxes, frustum, i))
+				expected.push_back(PICK_FIRST_ID + static_cast<int>(i));
+		}
+		check(!expected.empty() && ids == expected, "SIMD and scalar frustum tests select the same boxes");
+	}
+
+	void test_rectangle_clipping(ThreadPool* pool)
+	{
+		// Eye at the origin looking down -z, 90 degrees, so a point at depth d
+		// lands at x / d in NDC; the rectangle covers [-0.2, 0.2] of it
+		glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+		glm::mat4 projection = glm::perspective(glm::radians(90.f), 1.f, 1.f, 10.f);
+		glm::ivec4 viewport(0, 0, 100, 100), rect(40, 40, 20, 20);
+		auto box = [](const glm::vec3& center, const glm::vec3& size, float turn = 0.f) {
+			return glm::scale(glm::rotate(glm::translate(glm::mat4(1.f), center), turn, glm::vec3(0.f, 0.f, 1.f)), size);
+		};
+		struct Case { glm::mat4 model; bool window, crossing; const char* what; };
+		const Case cases[] = {
+			{ box(glm::vec3(0.f, 0.f, -5.f), glm::vec3(1.f)), true, true, "box inside the rectangle" },
+			{ box(glm::vec3(1.f, 0.f, -5.f), glm::vec3(1.f)), false, true, "box across the rectangle's edge" },
+			{ box(glm::vec3(2.f, 0.f, -5.f), glm::vec3(1.f)), false, false, "box just outside the rectangle's edge" },
+			{ box(glm::vec3(0.f, 0.f, -10.f), glm::vec3(1.f)), false, true, "box across the far plane" },
+			{ box(glm::vec3(0.f, 0.f, -12.f), glm::vec3(1.f)), false, false, "box beyond the far plane" },
+			{ box(glm::vec3(0.f, 0.f, -0.5f), glm::vec3(1.f, 1.f, 2.f)), false, true, "box across the near plane and the eye" },
+			// Its part past the near plane stays diagonally off the corner of the
+			// rectangle, though no single side plane of the region separates it
+			{ box(glm::vec3(0.45f, 0.45f, -0.5f), glm::vec3(0.3f * std::sqrt(2.f), 0.3f * std::sqrt(2.f), 1.4f), glm::radians(45.f)),
+				false, false, "box across the eye off the rectangle's corner" },
+			{ box(glm::vec3(0.f, 0.f, 5.f), glm::vec3(1.f)), false, false, "box behind the eye" },
+		};
+		std::vector<glm::mat4> models;
+		for (const Case& c : cases)
+			models.push_back(c.model);
+
+		FrustumSelector selector(pool);
+		selector.build(models, 0.5f);
+		for (bool simd : { true, false })
+		{
+			selector.set_simd(simd);
+			std::vector<int> window, crossing;
+			selector.select(rect, view, projection, viewport, RectangleSemantics::Window, window);
+			selector.select(rect, view, projection, viewport, RectangleSemantics::Crossing, crossing);
+			for (size_t i = 0; i < models.size(); i++)
+			{
+				int id = PICK_FIRST_ID + static_cast<int>(i);
+				std::string what = std::string(cases[i].what) + (simd ? " (SIMD)" : " (scalar)");
+				check(std::ranges::binary_search(window, id) == cases[i].window, ("window: " + what).c_str());
+				check(std::ranges::binary_search(crossing, id) == cases[i].crossing, ("crossing: " + what).c_str());
+			}
+		}
+	}
+
+	void test_bvh_raycast()
+	{
+		// Random boxes in a cube, rays from outside it aimed at random points inside
+		std::mt19937 random(3);
+		std::uniform_real_distribution<float> position(-100.f, 100.f), component(-1.f, 1.f), size(0.5f, 2.f);
+		std::vector<glm::mat4> models(300000);
+		for (glm::mat4& model : models)
+		{
+			glm::quat rotation = glm::normalize(glm::quat(component(random), component(random), component(random), component(random)));
+			glm::vec3 center(position(random), position(random), position(random));
+			model = glm::scale(glm::translate(glm::mat4(1.f), center) * glm::mat4_cast(rotation), glm::vec3(size(random)));
+		}
+		const float half = 0.5f;
+		BvhPicker bvh;
+		bvh.build(models, half);
+
+		const size_t ray_count = 10000;
+		std::vector<glm::vec3> origins(ray_count), directions(ray_count);
+		for (size_t r = 0; r < ray_count; r++)
+		{
+			origins[r] = 150.f * glm::normalize(glm::vec3(component(random), component(random), component(random)) + glm::vec3(0.f, 0.f, 1e-3f));
+			directions[r] = glm::vec3(position(random), position(random), position(random)) - origins[r];
+		}
+		std::vector<BvhPicker::Hit> hits(ray_count);
+		std::vector<bool> hit(ray_count);
+		auto start = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < ray_count; r++)
+			hit[r] = bvh.raycast(origins[r], directions[r], hits[r]);
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+		// Brute force over every box for some of the rays: the same slab test
+		// in each box's own space
+		std::vector<glm::mat4> to_local(models.size());
+		for (size_t i = 0; i < models.size(); i++)
+			to_local[i] = glm::inverse(models[i]);
+		bool same = true;
+		size_t hit_count = 0;
+		for (size_t r = 0; r < ray_count; r += 100)
+		{
+			glm::vec3 dir = glm::normalize(directions[r]);
+			float best_t = INFINITY;
+			int best_id = -1;
+			for (size_t i = 0; i < models.size(); i++)
+			{
+				glm::vec3 local_origin(to_local[i] * glm::vec4(origins[r], 1.f));
+				glm::vec3 inv_dir = 1.f / glm::vec3(to_local[i] * glm::vec4(dir, 0.f));
+				glm::vec3 t0 = (glm::vec3(-half) - local_origin) * inv_dir, t1 = (glm::vec3(half) - local_origin) * inv_dir;
+				glm::vec3 tnear = glm::min(t0, t1), tfar = glm::max(t0, t1);
+				float enter = std::max(std::max(tnear.x, tnear.y), std::max(tnear.z, 0.f));
+				float exit = std::min(std::min(tfar.x, tfar.y), tfar.z);
+				if (enter <= exit && enter < best_t)
+				{
+					best_t = enter;
+					best_id = PICK_FIRST_ID + static_cast<int>(i);
+				}
+			}
+			same = same && hit[r] == (best_id >= 0) && (!hit[r] || hits[r].id == best_id);
+			hit_count += hit[r];
+		}
+		check(hit_count > 0, "random rays hit some boxes");
+		check(same, "BVH ray cast finds the box brute force finds");
+		std::printf("BVH ray cast: %.2f us per ray on %zu boxes, %u levels\n", elapsed.count() / ray_count, models.size(), bvh.depth());
+	}
+}
+
+int main()
+{
+	ThreadPool pool;
+	test_subtree_updates(&pool);
+	test_large_subtree_update(&pool);
+	test_generator_determinism();
+	test_file_round_trip(&pool);
+	test_loader_chunks(&pool);
+	test_rectangle_paths(&pool);
+	test_rectangle_clipping(&pool);
+	test_bvh_raycast();
+	if (failures == 0)
+		std::printf("all scene tests passed\n");
+	return failures;
+}